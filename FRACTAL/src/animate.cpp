@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tbb/tbb.h"
+
+#include "../../common/fractal.hpp"
+#include "../../common/placement_tbb.hpp"
+#include "../../common/precision.hpp"
+
+// Zoom animation rendered as a four-stage pipeline: a serial stage hands
+// out frame views, then frame N+1 is computed, frame N colorized and
+// encoded and frame N-1 written all at the same time. liveFrames bounds
+// how many frames are in flight across the whole pipeline at once.
+
+const int iXmax = 1920;
+const int iYmax = 1080;
+const int IterationMax = 1000;
+// Kept as text so deep frames get the digits a double cannot hold.
+const char* CenterX = "-0.743643887037158704752191506114774";
+const char* CenterY = "0.131825904205311970493132056385139";
+const double StartWidth = 4.0;
+const double ZoomPerFrame = 0.95;
+const int MaxColorComponentValue = 255;
+const int liveFrames = 4;
+
+struct Frame {
+    int index;
+    DeepViewport view;
+    std::vector<int> iterations;
+    std::string encoded;
+};
+
+DeepViewport frameViewport(int index, const DoubleDouble& cx, const DoubleDouble& cy)
+{
+    double width = StartWidth * std::pow(ZoomPerFrame, index);
+    return { cx, cy, width / iXmax, iXmax, iYmax };
+}
+
+void computeFrame(Frame& frame)
+{
+    frame.iterations.resize(long(iXmax) * iYmax);
+    withPrecision(selectPrecision(frame.view), frame.view, IterationMax, 2, Mandelbrot(), [&](const auto& engine) {
+        tbb::parallel_for(tbb::blocked_range<int>(0, iYmax), [&](const tbb::blocked_range<int>& r) {
+            for (int iY = r.begin(); iY != r.end(); ++iY)
+                engine.renderRow(iY, 0, iXmax, frame.iterations.data() + long(iY) * iXmax);
+        });
+    });
+}
+
+void encodeFrame(Frame& frame)
+{
+    std::string header = "P6\n" + std::to_string(iXmax) + " " + std::to_string(iYmax) + "\n"
+        + std::to_string(MaxColorComponentValue) + "\n";
+    frame.encoded.resize(header.size() + long(iXmax) * iYmax * 3);
+    std::copy(header.begin(), header.end(), frame.encoded.begin());
+    unsigned char* out = reinterpret_cast<unsigned char*>(&frame.encoded[header.size()]);
+
+    tbb::parallel_for(tbb::blocked_range<long>(0, long(iXmax) * iYmax), [&](const tbb::blocked_range<long>& r) {
+        for (long i = r.begin(); i != r.end(); ++i) {
+            int it = frame.iterations[i];
+            if (it == IterationMax) {
+                out[3 * i] = out[3 * i + 1] = out[3 * i + 2] = 0;
+            } else {
+                double t = std::sqrt(double(it) / IterationMax);
+                out[3 * i] = (unsigned char)(MaxColorComponentValue * t);
+                out[3 * i + 1] = (unsigned char)(MaxColorComponentValue * t * t);
+                out[3 * i + 2] = (unsigned char)(MaxColorComponentValue * (1 - t));
+            }
+        }
+    });
+    std::vector<int>().swap(frame.iterations);
+}
+
+void writeFrame(const Frame& frame, const std::string& directory)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/frame_%04d.ppm", frame.index);
+    std::ofstream out(directory + name, std::ios::binary);
+    out.write(frame.encoded.data(), frame.encoded.size());
+}
+
+int main(int argc, char** argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 120;
+    std::string directory = argc > 2 ? argv[2] : "../frames";
+    DoubleDouble cx = DoubleDouble::parse(argc > 3 ? argv[3] : CenterX);
+    DoubleDouble cy = DoubleDouble::parse(argc > 4 ? argv[4] : CenterY);
+    std::filesystem::create_directories(directory);
+
+    Placement placement = Placement::fromEnv();
+    PlacementObserver observer(placement);
+
+    int next = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    tbb::parallel_pipeline(liveFrames,
+        tbb::make_filter<void, std::shared_ptr<Frame>>(tbb::filter_mode::serial_in_order,
+            [&](tbb::flow_control& fc) -> std::shared_ptr<Frame> {
+                if (next >= frames) {
+                    fc.stop();
+                    return nullptr;
+                }
+                auto frame = std::make_shared<Frame>();
+                frame->index = next;
+                frame->view = frameViewport(next, cx, cy);
+                ++next;
+                return frame;
+            })
+            & tbb::make_filter<std::shared_ptr<Frame>, std::shared_ptr<Frame>>(tbb::filter_mode::parallel,
+                [](std::shared_ptr<Frame> frame) {
+                    computeFrame(*frame);
+                    return frame;
+                })
+            & tbb::make_filter<std::shared_ptr<Frame>, std::shared_ptr<Frame>>(tbb::filter_mode::parallel,
+                [](std::shared_ptr<Frame> frame) {
+                    encodeFrame(*frame);
+                    return frame;
+                })
+            & tbb::make_filter<std::shared_ptr<Frame>, void>(tbb::filter_mode::serial_in_order,
+                [&](std::shared_ptr<Frame> frame) { writeFrame(*frame, directory); }));
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Frames: " << frames << ", time: " << seconds << " s, " << frames / seconds << " fps\n";
+
+    std::string fileName("../animation_times.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "frames,width,height,live_frames,threads,time_seconds,fps,placement\n";
+    csv << frames << "," << iXmax << "," << iYmax << "," << liveFrames << ","
+        << tbb::info::default_concurrency() << "," << seconds << "," << frames / seconds << ","
+        << observer.name() << "\n";
+    csv.close();
+    return 0;
+}
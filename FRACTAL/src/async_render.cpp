@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/async_render.hpp"
+
+// Exercises AsyncRenderer on one shared pool.
+//   Throughput - n clients each co_await a render of their own viewport at
+//                the same time; all of them share the pool's workers
+//   Cancel     - a large render is cancelled as soon as its first tile has
+//                been streamed; the latency is the time from cancel() until
+//                the task completes
+// Build: g++ -std=c++20 -fcoroutines -O2 -fopenmp-simd -pthread
+
+const int viewSize = 512;
+const int IterationMax = 2000;
+const int tileSize = 64;
+const int maxClients = 16;
+const int cancelViewSize = 2048;
+const int cancelRuns = 5;
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double>(to - from).count();
+}
+
+Viewport clientView(int client)
+{
+    // Neighbouring windows along the seahorse valley, one per client.
+    Viewport view;
+    double size = 0.05;
+    view.CxMin = -0.80 + 0.01 * client;
+    view.CxMax = view.CxMin + size;
+    view.CyMin = 0.10;
+    view.CyMax = view.CyMin + size;
+    view.iXmax = view.iYmax = viewSize;
+    return view;
+}
+
+Task<long> client(AsyncRenderer<Mandelbrot>& renderer, Viewport view)
+{
+    RenderOptions options;
+    options.tileSize = tileSize;
+    RenderResult result = co_await renderer.render(view, options);
+    long sum = 0;
+    for (int it : result.iterations)
+        sum += it;
+    co_return sum;
+}
+
+void runThroughput(WorkerPool& pool, std::ofstream& csv)
+{
+    AsyncRenderer<Mandelbrot> renderer(pool, IterationMax);
+    int tilesPerView = ((viewSize + tileSize - 1) / tileSize) * ((viewSize + tileSize - 1) / tileSize);
+
+    for (int clients = 1; clients <= maxClients; clients *= 2) {
+        auto start = Clock::now();
+        std::vector<std::future<long>> pending;
+        for (int c = 0; c < clients; ++c)
+            pending.push_back(startTask(client(renderer, clientView(c))));
+        long iterations = 0;
+        for (auto& f : pending)
+            iterations += f.get();
+        double time = seconds(start, Clock::now());
+
+        std::cout << "Throughput, threads: " << pool.threads() << ", clients: " << clients << ", " << time << " s, "
+                  << clients / time << " requests/s, " << clients * tilesPerView / time << " tiles/s, "
+                  << iterations / time / 1e6 << " Miter/s\n";
+        csv << "Throughput," << pool.threads() << "," << clients << "," << clients * tilesPerView << "," << time << ","
+            << pool.placementName() << "\n";
+    }
+}
+
+void runCancel(WorkerPool& pool, std::ofstream& csv)
+{
+    AsyncRenderer<Mandelbrot> renderer(pool, IterationMax * 4);
+    Viewport view;
+    view.iXmax = view.iYmax = cancelViewSize;
+
+    double total = 0, worst = 0;
+    for (int run = 0; run < cancelRuns; ++run) {
+        RenderOptions options;
+        options.tileSize = tileSize;
+        std::atomic<int> streamed { 0 };
+        options.onTile = [&](const TileRect&, const int*, int) { streamed.fetch_add(1); };
+
+        std::future<RenderResult> pending = startTask(renderer.render(view, options));
+        while (streamed.load() == 0)
+            std::this_thread::yield();
+
+        auto cancelled = Clock::now();
+        options.cancel.cancel();
+        RenderResult result = pending.get();
+        double latency = seconds(cancelled, Clock::now());
+        total += latency;
+        worst = std::max(worst, latency);
+
+        csv << "Cancel," << pool.threads() << ",1," << result.tilesRendered << "," << latency << ","
+            << pool.placementName() << "\n";
+        if (!result.cancelled)
+            std::cout << "Cancel: render finished before the token was seen\n";
+    }
+    std::cout << "Cancel, threads: " << pool.threads() << ", latency mean: " << total / cancelRuns * 1e3
+              << " ms, max: " << worst * 1e3 << " ms\n";
+}
+
+int main(int argc, char** argv)
+{
+    int maxRun = argc > 1 ? atoi(argv[1]) : int(std::thread::hardware_concurrency());
+
+    std::string fileName("../async_render.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "test,threads,requests,tiles_rendered,time_seconds,placement\n";
+
+    for (int threads = 1; threads <= std::max(maxRun, 1); threads *= 2) {
+        WorkerPool pool(threads, std::numeric_limits<size_t>::max(), Placement::fromEnv());
+        runThroughput(pool, csv);
+        runCancel(pool, csv);
+    }
+    csv.close();
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+#include "../../common/placement.hpp"
+
+// Buddhabrot: orbit density of escaping Mandelbrot points. Random c values
+// are traced in parallel and every point of an escaping orbit increments a
+// histogram bin. The accumulation strategy is selectable:
+//   Atomic  - one shared histogram, omp atomic per visit
+//   Private - a full histogram per thread, merged pairwise in a tree
+//   Striped - the shared histogram is split into row stripes with a lock
+//             each; threads buffer visits per stripe and flush when full
+//
+// Sample i always uses random numbers (seed, i), so the histogram is the
+// same at every thread count.
+
+const int iXmax = 2000;
+const int iYmax = 2000;
+const double CxMin = -2.0;
+const double CxMax = 2.0;
+const double CyMin = -2.0;
+const double CyMax = 2.0;
+const int IterationMax = 2000;
+const double EscapeRadius = 2;
+const long samples = 20000000;
+const uint64_t seed = 0x5eed;
+const int stripes = 64;
+const int stripeBuffer = 1024;
+Placement placement = Placement::fromEnv();
+
+typedef uint32_t Bin;
+
+// Counter-based generator: a stateless mix of (key, counter), so any sample
+// can be generated independently of the others.
+uint64_t mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+double uniform(uint64_t key, uint64_t counter)
+{
+    return (mix64(key ^ mix64(counter)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool insideMainBulbs(double Cx, double Cy)
+{
+    double q = (Cx - 0.25) * (Cx - 0.25) + Cy * Cy;
+    if (q * (q + (Cx - 0.25)) <= 0.25 * Cy * Cy)
+        return true;
+    return (Cx + 1) * (Cx + 1) + Cy * Cy <= 0.0625;
+}
+
+// Traces sample i and calls visit(bin) for every orbit point inside the
+// image if the orbit escapes. Returns the number of visits.
+template <typename Visit>
+long traceSample(long i, std::vector<double>& orbit, Visit visit)
+{
+    double Cx = CxMin + (CxMax - CxMin) * uniform(seed, 2 * i);
+    double Cy = CyMin + (CyMax - CyMin) * uniform(seed, 2 * i + 1);
+    if (insideMainBulbs(Cx, Cy))
+        return 0;
+
+    double Zx = 0, Zy = 0, Zx2 = 0, Zy2 = 0;
+    double ER2 = EscapeRadius * EscapeRadius;
+    int Iteration;
+    for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2; Iteration++) {
+        Zy = 2 * Zx * Zy + Cy;
+        Zx = Zx2 - Zy2 + Cx;
+        Zx2 = Zx * Zx;
+        Zy2 = Zy * Zy;
+        orbit[2 * Iteration] = Zx;
+        orbit[2 * Iteration + 1] = Zy;
+    }
+    if (Iteration == IterationMax)
+        return 0;
+
+    long visits = 0;
+    for (int k = 0; k < Iteration; ++k) {
+        int iX = int((orbit[2 * k] - CxMin) / (CxMax - CxMin) * iXmax);
+        int iY = int((orbit[2 * k + 1] - CyMin) / (CyMax - CyMin) * iYmax);
+        if (iX >= 0 && iX < iXmax && iY >= 0 && iY < iYmax) {
+            visit(long(iY) * iXmax + iX);
+            ++visits;
+        }
+    }
+    return visits;
+}
+
+size_t accumulateAtomic(std::vector<Bin>& histogram)
+{
+#pragma omp parallel
+    {
+        std::vector<double> orbit(2 * IterationMax);
+#pragma omp for schedule(dynamic, 4096)
+        for (long i = 0; i < samples; ++i) {
+            traceSample(i, orbit, [&](long bin) {
+#pragma omp atomic
+                histogram[bin]++;
+            });
+        }
+    }
+    return 0;
+}
+
+size_t accumulatePrivate(std::vector<Bin>& histogram)
+{
+    int threads = omp_get_max_threads();
+    std::vector<std::vector<Bin>> local(threads);
+
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        int nthreads = omp_get_num_threads();
+        local[tid].assign(histogram.size(), 0);
+        std::vector<double> orbit(2 * IterationMax);
+        Bin* mine = local[tid].data();
+
+#pragma omp for schedule(dynamic, 4096)
+        for (long i = 0; i < samples; ++i)
+            traceSample(i, orbit, [&](long bin) { mine[bin]++; });
+
+        // Tree merge: after round s, thread t holds the sum of threads
+        // [t, t + 2s). Every round is a barrier, log2(threads) rounds total.
+        for (int stride = 1; stride < nthreads; stride *= 2) {
+            if (tid % (2 * stride) == 0 && tid + stride < nthreads) {
+                const Bin* other = local[tid + stride].data();
+                for (size_t b = 0; b < histogram.size(); ++b)
+                    mine[b] += other[b];
+            }
+#pragma omp barrier
+        }
+
+#pragma omp for schedule(static)
+        for (size_t b = 0; b < histogram.size(); ++b)
+            histogram[b] = local[0][b];
+    }
+    return size_t(threads) * histogram.size() * sizeof(Bin);
+}
+
+size_t accumulateStriped(std::vector<Bin>& histogram)
+{
+    const long stripeBins = (long(histogram.size()) + stripes - 1) / stripes;
+    std::vector<omp_lock_t> locks(stripes);
+    for (auto& lock : locks)
+        omp_init_lock(&lock);
+
+#pragma omp parallel
+    {
+        std::vector<double> orbit(2 * IterationMax);
+        std::vector<std::vector<uint32_t>> pending(stripes);
+        for (auto& p : pending)
+            p.reserve(stripeBuffer);
+
+        auto flush = [&](int s) {
+            omp_set_lock(&locks[s]);
+            for (uint32_t bin : pending[s])
+                histogram[bin]++;
+            omp_unset_lock(&locks[s]);
+            pending[s].clear();
+        };
+
+#pragma omp for schedule(dynamic, 4096)
+        for (long i = 0; i < samples; ++i) {
+            traceSample(i, orbit, [&](long bin) {
+                int s = int(bin / stripeBins);
+                pending[s].push_back(uint32_t(bin));
+                if (pending[s].size() == stripeBuffer)
+                    flush(s);
+            });
+        }
+        for (int s = 0; s < stripes; ++s)
+            if (!pending[s].empty())
+                flush(s);
+    }
+
+    for (auto& lock : locks)
+        omp_destroy_lock(&lock);
+    return size_t(omp_get_max_threads()) * stripes * stripeBuffer * sizeof(uint32_t);
+}
+
+template <typename Func>
+double runExperiment(const std::string& name, Func func, std::ofstream& csv)
+{
+    std::vector<Bin> histogram(long(iXmax) * iYmax, 0);
+
+    double start = omp_get_wtime();
+    size_t extraBytes = func(histogram);
+    double end = omp_get_wtime();
+
+    uint64_t checksum = 0;
+    long visits = 0;
+    for (size_t b = 0; b < histogram.size(); ++b) {
+        checksum = mix64(checksum ^ (uint64_t(b) << 32 | histogram[b]));
+        visits += histogram[b];
+    }
+
+    std::cout << name << ": " << end - start << " s, visits: " << visits << ", checksum: " << std::hex
+              << checksum << std::dec << ", extra memory: " << extraBytes / 1024 << " KiB\n";
+    csv << name << "," << omp_get_max_threads() << "," << iXmax << "," << samples << "," << extraBytes << ","
+        << visits << "," << std::hex << checksum << std::dec << "," << end - start << "," << placement.name() << "\n";
+
+    Bin maxBin = *std::max_element(histogram.begin(), histogram.end());
+    std::ofstream out("../buddhabrot_" + name + ".pgm", std::ios::binary);
+    out << "P5\n"
+        << iXmax << " " << iYmax << "\n255\n";
+    for (Bin b : histogram) {
+        unsigned char v = maxBin ? (unsigned char)(255 * std::log1p(double(b)) / std::log1p(double(maxBin))) : 0;
+        out.write(reinterpret_cast<char*>(&v), 1);
+    }
+    return end - start;
+}
+
+int main(int argc, char** argv)
+{
+    std::string fileName("../buddhabrot_times.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "method,threads,size,samples,extra_bytes,visits,checksum,time_seconds,placement\n";
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+
+    std::string strategy = argc > 1 ? argv[1] : "all";
+    if (strategy == "all" || strategy == "atomic")
+        runExperiment("Atomic", accumulateAtomic, csv);
+    if (strategy == "all" || strategy == "private")
+        runExperiment("Private", accumulatePrivate, csv);
+    if (strategy == "all" || strategy == "striped")
+        runExperiment("Striped", accumulateStriped, csv);
+
+    csv.close();
+    return 0;
+}
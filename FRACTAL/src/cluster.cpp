@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../../common/fractal.hpp"
+#include "../../common/placement.hpp"
+
+// Coordinator/worker renderer. The coordinator splits the frame into tiles
+// and hands them out over a Unix domain socket; workers are separate
+// processes that write iteration counts straight into a shared-memory frame
+// buffer and only send a short Done message back. Workers that stop sending
+// heartbeats have their tiles reassigned.
+//
+//   cluster [workers] [--kill N]   - coordinator, kills worker N mid-frame
+//   cluster worker <socket> <shm> <index> - worker, started by the coordinator
+
+const int iXmax = 8000;
+const int iYmax = 8000;
+const int IterationMax = 500;
+const int tileSize = 256;
+const int tilesInFlight = 2;
+const auto heartbeatInterval = std::chrono::milliseconds(100);
+const auto heartbeatTimeout = std::chrono::milliseconds(1000);
+const auto helloTimeout = std::chrono::milliseconds(5000);
+Placement placement = Placement::fromEnv();
+
+enum MessageType : uint32_t {
+    Hello = 1,
+    Assign = 2,
+    Done = 3,
+    Heartbeat = 4,
+    Shutdown = 5
+};
+
+struct Message {
+    uint32_t type;
+    uint32_t tile;
+    int32_t x0, y0, width, height;
+    // Hello only: the worker's pid and whether it could pin itself.
+    int32_t pid = 0;
+    int32_t pinned = 0;
+};
+
+struct TileJob {
+    int x0, y0, width, height;
+};
+
+std::vector<TileJob> makeTiles()
+{
+    std::vector<TileJob> tiles;
+    for (int y = 0; y < iYmax; y += tileSize)
+        for (int x = 0; x < iXmax; x += tileSize)
+            tiles.push_back({ x, y, std::min(tileSize, iXmax - x), std::min(tileSize, iYmax - y) });
+    return tiles;
+}
+
+int* mapFrame(const std::string& shmName, bool create)
+{
+    size_t bytes = sizeof(int) * size_t(iXmax) * iYmax;
+    int fd = shm_open(shmName.c_str(), create ? O_CREAT | O_RDWR | O_TRUNC : O_RDWR, 0600);
+    if (fd < 0 || (create && ftruncate(fd, bytes) < 0)) {
+        perror("shm_open");
+        exit(1);
+    }
+    void* frame = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (frame == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return static_cast<int*>(frame);
+}
+
+///////////////////////////////////////////
+
+int workerMain(const std::string& socketPath, const std::string& shmName, int index)
+{
+    // Pinned before the heartbeat thread starts, so it inherits the mask.
+    bool pinned = placement.pinCurrentThread(index);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("connect");
+        return 1;
+    }
+
+    int* frame = mapFrame(shmName, false);
+    Viewport view { -2.5, 1.5, -2.0, 2.0, iXmax, iYmax };
+    EscapeTimeEngine<Mandelbrot> engine(view, IterationMax);
+
+    std::mutex sendMutex;
+    auto sendMessage = [&](const Message& m) {
+        std::lock_guard<std::mutex> guard(sendMutex);
+        return send(fd, &m, sizeof(m), MSG_NOSIGNAL) == ssize_t(sizeof(m));
+    };
+
+    sendMessage({ Hello, 0, 0, 0, 0, 0, int32_t(getpid()), pinned });
+
+    std::atomic<bool> running { true };
+    std::thread heartbeat([&] {
+        while (running) {
+            if (!sendMessage({ Heartbeat, 0, 0, 0, 0, 0 }))
+                return;
+            std::this_thread::sleep_for(heartbeatInterval);
+        }
+    });
+
+    Message m;
+    while (recv(fd, &m, sizeof(m), 0) == ssize_t(sizeof(m)) && m.type == Assign) {
+        for (int iY = m.y0; iY < m.y0 + m.height; ++iY)
+            engine.renderRow(iY, m.x0, m.x0 + m.width, frame + long(iY) * iXmax + m.x0);
+        sendMessage({ Done, m.tile, m.x0, m.y0, m.width, m.height });
+    }
+
+    running = false;
+    heartbeat.join();
+    close(fd);
+    return 0;
+}
+
+///////////////////////////////////////////
+
+struct WorkerState {
+    pid_t pid;
+    int fd = -1;
+    bool alive = true;
+    bool exited = false; // already reaped, the pid may be reused
+    std::vector<uint32_t> assigned;
+    std::chrono::steady_clock::time_point lastSeen;
+};
+
+class Coordinator {
+public:
+    Coordinator(int workers, int killWorker)
+        : Workers(workers)
+        , KillWorker(killWorker)
+        , tiles(makeTiles())
+    {
+        socketPath = "/tmp/mandelbrot_cluster_" + std::to_string(getpid()) + ".sock";
+        shmName = "/mandelbrot_cluster_" + std::to_string(getpid());
+    }
+
+    // Workers are started from /proc/self/exe, not argv[0], which may be
+    // relative to another directory or only resolvable through PATH.
+    double run(const char* name)
+    {
+        frame = mapFrame(shmName, true);
+        listenFd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(socketPath.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, Workers) < 0) {
+            perror("bind");
+            exit(1);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < Workers; ++i) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                std::string index = std::to_string(i);
+                execl("/proc/self/exe", name, "worker", socketPath.c_str(), shmName.c_str(), index.c_str(), nullptr);
+                _exit(127);
+            }
+            WorkerState w;
+            w.pid = pid;
+            workers.push_back(w);
+        }
+        // Workers connect in any order, Hello carries the pid to match them up
+        // and whether the worker managed to pin itself.
+        // Startup ends once every worker has either said hello or exited, or
+        // at the deadline; the frame is rendered by whoever made it.
+        auto deadline = std::chrono::steady_clock::now() + helloTimeout;
+        for (;;) {
+            bool waiting = false;
+            for (auto& w : workers) {
+                if (w.fd < 0 && !w.exited && waitpid(w.pid, nullptr, WNOHANG) == w.pid)
+                    w.exited = true;
+                waiting = waiting || (w.fd < 0 && !w.exited);
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (!waiting || left.count() <= 0)
+                break;
+
+            pollfd listener { listenFd, POLLIN, 0 };
+            if (poll(&listener, 1, int(std::min(left, heartbeatInterval).count())) <= 0)
+                continue;
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            // Hello is the first thing a worker sends, do not wait on one that connected and stalled.
+            pollfd peer { fd, POLLIN, 0 };
+            Message hello;
+            if (poll(&peer, 1, int(heartbeatTimeout.count())) <= 0
+                || recv(fd, &hello, sizeof(hello), 0) != ssize_t(sizeof(hello)) || hello.type != Hello) {
+                close(fd);
+                continue;
+            }
+            bool matched = false;
+            for (auto& w : workers) {
+                if (w.pid == pid_t(hello.pid) && w.fd < 0) {
+                    if (!hello.pinned)
+                        placement.markUnpinned();
+                    w.fd = fd;
+                    w.lastSeen = std::chrono::steady_clock::now();
+                    matched = true;
+                }
+            }
+            if (!matched)
+                close(fd);
+        }
+        for (auto& w : workers) {
+            if (w.fd < 0)
+                markDead(w, w.exited ? "exited before saying hello" : "never said hello");
+        }
+
+        for (uint32_t t = 0; t < tiles.size(); ++t)
+            pending.push_back(t);
+        doneCount = 0;
+        std::vector<bool> done(tiles.size(), false);
+
+        while (doneCount < tiles.size()) {
+            for (auto& w : workers)
+                assignWork(w);
+
+            std::vector<pollfd> fds;
+            std::vector<int> owner;
+            for (int i = 0; i < int(workers.size()); ++i) {
+                if (workers[i].alive) {
+                    fds.push_back({ workers[i].fd, POLLIN, 0 });
+                    owner.push_back(i);
+                }
+            }
+            if (fds.empty()) {
+                std::cerr << "All workers died\n";
+                break;
+            }
+            poll(fds.data(), fds.size(), int(heartbeatInterval.count()));
+
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < fds.size(); ++i) {
+                WorkerState& w = workers[owner[i]];
+                if (fds[i].revents & POLLIN) {
+                    Message m;
+                    if (recv(w.fd, &m, sizeof(m), 0) != ssize_t(sizeof(m))) {
+                        markDead(w, "closed its socket");
+                        continue;
+                    }
+                    w.lastSeen = now;
+                    if (m.type == Done) {
+                        w.assigned.erase(std::remove(w.assigned.begin(), w.assigned.end(), m.tile), w.assigned.end());
+                        if (!done[m.tile]) {
+                            done[m.tile] = true;
+                            ++doneCount;
+                        }
+                        if (KillWorker >= 0 && doneCount >= tiles.size() / 4) {
+                            std::cout << "Killing worker " << KillWorker << "\n";
+                            if (workers[KillWorker].alive)
+                                kill(workers[KillWorker].pid, SIGKILL);
+                            KillWorker = -1;
+                        }
+                    }
+                } else if (fds[i].revents & (POLLHUP | POLLERR)) {
+                    markDead(w, "hung up");
+                } else if (now - w.lastSeen > heartbeatTimeout) {
+                    markDead(w, "missed its heartbeat");
+                }
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        for (auto& w : workers) {
+            if (w.alive) {
+                Message m { Shutdown, 0, 0, 0, 0, 0 };
+                send(w.fd, &m, sizeof(m), MSG_NOSIGNAL);
+            }
+            if (w.fd >= 0)
+                close(w.fd);
+            if (!w.exited)
+                waitpid(w.pid, nullptr, 0);
+        }
+        close(listenFd);
+        unlink(socketPath.c_str());
+        shm_unlink(shmName.c_str());
+
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    const int* frameBuffer() const { return frame; }
+    int reassignedTiles() const { return reassigned; }
+    int deadWorkers() const { return dead; }
+
+private:
+    int Workers;
+    int KillWorker;
+    std::vector<TileJob> tiles;
+    std::vector<WorkerState> workers;
+    std::deque<uint32_t> pending;
+    size_t doneCount = 0;
+    int reassigned = 0;
+    int dead = 0;
+
+    std::string socketPath;
+    std::string shmName;
+    int listenFd = -1;
+    int* frame = nullptr;
+
+    void assignWork(WorkerState& w)
+    {
+        while (w.alive && int(w.assigned.size()) < tilesInFlight && !pending.empty()) {
+            uint32_t t = pending.front();
+            pending.pop_front();
+            const TileJob& job = tiles[t];
+            Message m { Assign, t, job.x0, job.y0, job.width, job.height };
+            if (send(w.fd, &m, sizeof(m), MSG_NOSIGNAL) != ssize_t(sizeof(m))) {
+                pending.push_front(t);
+                markDead(w, "refused work");
+                return;
+            }
+            w.assigned.push_back(t);
+        }
+    }
+
+    // A dead worker may have written part of its tiles; they are rendered
+    // again from scratch by whoever picks them up.
+    void markDead(WorkerState& w, const char* reason)
+    {
+        std::cout << "Worker " << w.pid << " " << reason << ", reassigning " << w.assigned.size() << " tiles\n";
+        w.alive = false;
+        ++dead;
+        reassigned += int(w.assigned.size());
+        for (uint32_t t : w.assigned)
+            pending.push_front(t);
+        w.assigned.clear();
+        if (!w.exited)
+            kill(w.pid, SIGKILL);
+    }
+};
+
+int main(int argc, char** argv)
+{
+    if (argc >= 5 && std::string(argv[1]) == "worker")
+        return workerMain(argv[2], argv[3], atoi(argv[4]));
+
+    int workers = 4;
+    int killWorker = -1;
+    bool killRequested = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--kill" && i + 1 < argc) {
+            killWorker = atoi(argv[++i]);
+            killRequested = true;
+        } else {
+            workers = atoi(argv[i]);
+        }
+    }
+    if (workers < 1 || (killRequested && (killWorker < 0 || killWorker >= workers))) {
+        std::cerr << "usage: cluster [workers] [--kill N], workers >= 1 and 0 <= N < workers\n";
+        return 1;
+    }
+
+    Coordinator coordinator(workers, killWorker);
+    double seconds = coordinator.run(argv[0]);
+
+    long sum = 0;
+    const int* frame = coordinator.frameBuffer();
+    for (long i = 0; i < long(iXmax) * iYmax; ++i)
+        sum += frame[i];
+    std::cout << "Workers: " << workers << ", time: " << seconds << " s, iterations: " << sum
+              << ", reassigned tiles: " << coordinator.reassignedTiles() << "\n";
+
+    std::string fileName("../cluster_times.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "workers,size,tileSize,dead_workers,reassigned_tiles,time_seconds,placement\n";
+    csv << workers << "," << iXmax << "," << tileSize << "," << coordinator.deadWorkers() << ","
+        << coordinator.reassignedTiles() << "," << seconds << "," << placement.name() << "\n";
+    csv.close();
+    return 0;
+}
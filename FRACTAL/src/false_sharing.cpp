@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/metrics.hpp"
+#include "../../common/placement.hpp"
+
+// Cost of per-thread counters in the old layout against ThreadMetrics.
+//   Packed - long sum[threads], the layout LAB02 used: neighbouring threads
+//            write to the same cache line on every update
+//   Padded - one MetricsSlot per thread, still written on every update
+//   Local  - a MetricsSlot on the thread's stack, merged once at the end
+// The counters are written through volatile pointers so the compiler cannot
+// keep them in registers, which is what the old code relied on not happening.
+
+const long updatesPerThread = 50000000;
+const int maxThreads = 64;
+
+Placement placement = Placement::fromEnv();
+
+std::vector<long> packed(maxThreads);
+ThreadMetrics padded(maxThreads);
+
+inline long work(long i)
+{
+    return (i * 0x9e3779b97f4a7c15ull) >> 61;
+}
+
+template <typename Body>
+double timeThreads(int threads, Body body)
+{
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int tid = 0; tid < threads; ++tid) {
+        workers.emplace_back(body, tid);
+        if (!placement.pinThread(workers.back().native_handle(), tid))
+            placement.markUnpinned();
+    }
+    for (auto& w : workers)
+        w.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double runPacked(int threads)
+{
+    std::fill(packed.begin(), packed.end(), 0);
+    return timeThreads(threads, [](int tid) {
+        volatile long* sum = &packed[tid];
+        for (long i = 0; i < updatesPerThread; ++i)
+            *sum = *sum + work(i);
+    });
+}
+
+double runPadded(int threads)
+{
+    padded.reset();
+    return timeThreads(threads, [](int tid) {
+        volatile long* sum = &padded[tid].counters[Iterations];
+        for (long i = 0; i < updatesPerThread; ++i)
+            *sum = *sum + work(i);
+    });
+}
+
+double runLocal(int threads)
+{
+    padded.reset();
+    return timeThreads(threads, [](int tid) {
+        MetricsSlot local;
+        volatile long* sum = &local.counters[Iterations];
+        for (long i = 0; i < updatesPerThread; ++i)
+            *sum = *sum + work(i);
+        padded.merge(tid, local);
+    });
+}
+
+int main(int argc, char** argv)
+{
+    int maxRun = std::min(argc > 1 ? atoi(argv[1]) : int(std::thread::hardware_concurrency()), maxThreads);
+
+    std::string fileName("../false_sharing.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "layout,threads,updates,time_seconds,ns_per_update,placement\n";
+
+    for (int threads = 1; threads <= maxRun; threads *= 2) {
+        for (auto [name, run] : { std::pair<const char*, double (*)(int)> { "Packed", runPacked },
+                 { "Padded", runPadded }, { "Local", runLocal } }) {
+            double seconds = run(threads);
+            double ns = seconds * 1e9 / updatesPerThread;
+            std::cout << name << ", threads: " << threads << ", " << seconds << " s, " << ns << " ns/update\n";
+            csv << name << "," << threads << "," << updatesPerThread * threads << "," << seconds << "," << ns << ","
+                << placement.name() << "\n";
+        }
+    }
+    csv.close();
+    return 0;
+}
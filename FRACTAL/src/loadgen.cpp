@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Closed-loop load generator for server.cpp. Every client keeps one
+// keep-alive connection and sends its next request as soon as the previous
+// answer arrives. Half of the requests go to a small hot set of tiles so
+// concurrent clients ask for the same tile and exercise request coalescing.
+
+const int requestsPerClient = 200;
+const int zoomLevel = 6;
+const int hotTiles = 16;
+
+struct ClientResult {
+    std::vector<double> latencies;
+    long ok = 0;
+    long rejected = 0;
+    long failed = 0;
+};
+
+bool readResponse(int fd, std::string& buffer, int& status)
+{
+    char chunk[65536];
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+    }
+
+    status = atoi(buffer.c_str() + buffer.find(' ') + 1);
+    size_t lengthPos = buffer.find("Content-Length: ");
+    size_t length = lengthPos < headerEnd ? std::stoul(buffer.substr(lengthPos + 16)) : 0;
+
+    while (buffer.size() < headerEnd + 4 + length) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+    }
+    buffer.erase(0, headerEnd + 4 + length);
+    return true;
+}
+
+void client(int tid, int port, ClientResult& result)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("connect");
+        result.failed = requestsPerClient;
+        close(fd);
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::mt19937 g(tid);
+    std::uniform_int_distribution<> anyTile(0, (1 << zoomLevel) - 1);
+    std::uniform_int_distribution<> hotTile(0, hotTiles - 1);
+    std::string buffer;
+
+    for (int r = 0; r < requestsPerClient; ++r) {
+        int x, y;
+        if (r % 2 == 0) {
+            int h = hotTile(g);
+            x = (1 << (zoomLevel - 1)) + h % 4;
+            y = (1 << (zoomLevel - 1)) + h / 4;
+        } else {
+            x = anyTile(g);
+            y = anyTile(g);
+        }
+        std::string request = "GET /tile/" + std::to_string(zoomLevel) + "/" + std::to_string(x) + "/"
+            + std::to_string(y) + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+        auto start = std::chrono::steady_clock::now();
+        int status = 0;
+        if (write(fd, request.data(), request.size()) != ssize_t(request.size()) || !readResponse(fd, buffer, status)) {
+            result.failed += requestsPerClient - r;
+            break;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        if (status == 200) {
+            result.ok++;
+            result.latencies.push_back(std::chrono::duration<double>(end - start).count());
+        } else if (status == 503) {
+            result.rejected++;
+        } else {
+            result.failed++;
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char** argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 8080;
+    int clients = argc > 2 ? atoi(argv[2]) : 32;
+
+    std::vector<ClientResult> results(clients);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < clients; ++i)
+        threads.emplace_back(client, i, port, std::ref(results[i]));
+    for (auto& t : threads)
+        t.join();
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    std::vector<double> latencies;
+    long ok = 0, rejected = 0, failed = 0;
+    for (auto& r : results) {
+        latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+        ok += r.ok;
+        rejected += r.rejected;
+        failed += r.failed;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+    };
+
+    std::cout << "Clients: " << clients << ", tiles: " << ok << ", rejected: " << rejected
+              << ", failed: " << failed << "\n"
+              << "p50: " << percentile(0.50) * 1000 << " ms, p99: " << percentile(0.99) * 1000 << " ms\n"
+              << "Throughput: " << ok / seconds << " tiles/s\n";
+
+    std::string fileName("../server_load.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "clients,tiles,rejected,failed,p50_ms,p99_ms,tiles_per_second\n";
+    csv << clients << "," << ok << "," << rejected << "," << failed << "," << percentile(0.50) * 1000 << ","
+        << percentile(0.99) * 1000 << "," << ok / seconds << "\n";
+    csv.close();
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <mutex>
+#include <omp.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tbb/tbb.h"
+
+#include "../../common/fractal.hpp"
+#include "../../common/placement.hpp"
+#include "../../common/placement_tbb.hpp"
+
+// Runtime overheads behind the design choices of the labs, per thread count:
+//   ForkJoin - start and join a team doing nothing: std::thread (LAB01-03),
+//              omp parallel (LAB04-06), tbb::parallel_for (FRACTAL)
+//   Spawn    - one empty task spawned and awaited: omp task, tbb::task_group
+//   Barrier  - one omp barrier
+//   Acquire  - one contended increment: std::atomic, std::mutex, omp_lock_t,
+//              omp critical
+//   Nested   - an outer team of 2 each forking an inner team of threads / 2,
+//              to compare with the flat omp parallel fork at the same size
+// Every case is repeated, doubling the count, until it runs for minSeconds.
+// The minimum grain is the work per parallel unit that keeps the overhead
+// under 10%, also given in Mandelbrot iterations.
+
+const double minSeconds = 0.2;
+const double overheadShare = 0.1;
+const int tasksPerRegion = 1000;
+
+Placement placement = Placement::fromEnv();
+
+using Clock = std::chrono::steady_clock;
+
+// The body of every region and task, so the compiler cannot drop them.
+inline void touch()
+{
+    volatile int unit = 0;
+    (void)unit;
+}
+
+// Nanoseconds per operation; body(reps) performs reps operations.
+template <typename Body>
+double measure(Body body)
+{
+    body(1);
+    for (long reps = 1;; reps *= 2) {
+        auto start = Clock::now();
+        body(reps);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= minSeconds)
+            return seconds * 1e9 / reps;
+    }
+}
+
+double iterationNs()
+{
+    Viewport view;
+    EscapeTimeEngine<Mandelbrot> engine(view, 1000);
+    std::vector<int> iterations(view.iXmax);
+    long total = 0;
+    auto start = Clock::now();
+    for (int iY = view.iYmax / 4; iY < view.iYmax / 2; ++iY)
+        total += engine.renderRow(iY, 0, view.iXmax, iterations.data());
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1e9 / total;
+}
+
+double threadForkJoin(int threads)
+{
+    return measure([&](long reps) {
+        for (long r = 0; r < reps; ++r) {
+            std::vector<std::thread> team;
+            for (int t = 0; t < threads; ++t) {
+                team.emplace_back(touch);
+                if (!placement.pinThread(team.back().native_handle(), t))
+                    placement.markUnpinned();
+            }
+            for (auto& t : team)
+                t.join();
+        }
+    });
+}
+
+double ompForkJoin(int threads)
+{
+    return measure([&](long reps) {
+        for (long r = 0; r < reps; ++r) {
+#pragma omp parallel num_threads(threads)
+            touch();
+        }
+    });
+}
+
+double tbbForkJoin(int threads)
+{
+    tbb::task_arena arena(threads);
+    return measure([&](long reps) {
+        arena.execute([&] {
+            for (long r = 0; r < reps; ++r)
+                tbb::parallel_for(0, threads, [](int) { touch(); }, tbb::simple_partitioner());
+        });
+    });
+}
+
+double ompSpawn(int threads)
+{
+    return measure([&](long reps) {
+        for (long r = 0; r < reps; ++r) {
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+            {
+                for (int i = 0; i < tasksPerRegion; ++i) {
+#pragma omp task
+                    touch();
+                }
+#pragma omp taskwait
+            }
+        }
+    }) / tasksPerRegion;
+}
+
+double tbbSpawn(int threads)
+{
+    tbb::task_arena arena(threads);
+    return measure([&](long reps) {
+        arena.execute([&] {
+            for (long r = 0; r < reps; ++r) {
+                tbb::task_group group;
+                for (int i = 0; i < tasksPerRegion; ++i)
+                    group.run(touch);
+                group.wait();
+            }
+        });
+    }) / tasksPerRegion;
+}
+
+double ompBarrier(int threads)
+{
+    return measure([&](long reps) {
+#pragma omp parallel num_threads(threads)
+        for (long r = 0; r < reps; ++r) {
+#pragma omp barrier
+        }
+    });
+}
+
+// Every thread performs reps acquisitions; the cost is per acquisition as
+// seen by one thread, so it grows with contention.
+template <typename Acquire>
+double contended(int threads, Acquire acquire)
+{
+    return measure([&](long reps) {
+#pragma omp parallel num_threads(threads)
+        for (long r = 0; r < reps; ++r)
+            acquire();
+    });
+}
+
+double atomicAcquire(int threads)
+{
+    std::atomic<long> counter { 0 };
+    return contended(threads, [&] { counter.fetch_add(1, std::memory_order_relaxed); });
+}
+
+double mutexAcquire(int threads)
+{
+    std::mutex mtx;
+    long counter = 0;
+    return contended(threads, [&] {
+        std::lock_guard<std::mutex> guard(mtx);
+        ++counter;
+    });
+}
+
+double ompLockAcquire(int threads)
+{
+    omp_lock_t lock;
+    omp_init_lock(&lock);
+    long counter = 0;
+    double ns = contended(threads, [&] {
+        omp_set_lock(&lock);
+        ++counter;
+        omp_unset_lock(&lock);
+    });
+    omp_destroy_lock(&lock);
+    return ns;
+}
+
+double ompCritical(int threads)
+{
+    long counter = 0;
+    return contended(threads, [&] {
+#pragma omp critical
+        ++counter;
+    });
+}
+
+// omp_set_nested is deprecated since OpenMP 5.0; two active levels is the
+// same setting.
+double ompNested(int threads)
+{
+    int levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+    int inner = std::max(1, threads / 2);
+    double ns = measure([&](long reps) {
+        for (long r = 0; r < reps; ++r) {
+#pragma omp parallel num_threads(2)
+#pragma omp parallel num_threads(inner)
+            touch();
+        }
+    });
+    omp_set_max_active_levels(levels);
+    return ns;
+}
+
+int main(int argc, char** argv)
+{
+    int maxRun = argc > 1 ? atoi(argv[1]) : int(std::thread::hardware_concurrency());
+    PlacementObserver observer(placement);
+
+    double perIteration = iterationNs();
+    std::cout << "Mandelbrot iteration: " << perIteration << " ns\n";
+
+    std::string fileName("../overheads.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "benchmark,backend,threads,ns_per_op,min_grain_ns,min_grain_iterations,placement\n";
+
+    struct Case {
+        const char* benchmark;
+        const char* backend;
+        double (*run)(int);
+    };
+    const Case cases[] = {
+        { "ForkJoin", "std::thread", threadForkJoin },
+        { "ForkJoin", "omp parallel", ompForkJoin },
+        { "ForkJoin", "tbb::parallel_for", tbbForkJoin },
+        { "Spawn", "omp task", ompSpawn },
+        { "Spawn", "tbb::task_group", tbbSpawn },
+        { "Barrier", "omp barrier", ompBarrier },
+        { "Acquire", "std::atomic", atomicAcquire },
+        { "Acquire", "std::mutex", mutexAcquire },
+        { "Acquire", "omp_lock_t", ompLockAcquire },
+        { "Acquire", "omp critical", ompCritical },
+        { "Nested", "omp parallel 2x", ompNested },
+    };
+
+    for (int threads = 1; threads <= std::max(maxRun, 1); threads *= 2) {
+        omp_set_num_threads(threads);
+        if (!placement.pinOpenMP())
+            placement.markUnpinned();
+        for (const Case& c : cases) {
+            double ns = c.run(threads);
+            double grain = ns / overheadShare;
+            std::cout << c.benchmark << ", " << c.backend << ", threads: " << threads << ", " << ns
+                      << " ns, min grain: " << grain / 1e3 << " us (" << long(grain / perIteration)
+                      << " iterations)\n";
+            csv << c.benchmark << "," << c.backend << "," << threads << "," << ns << "," << grain << ","
+                << long(grain / perIteration) << "," << (placement.pinned() ? observer.name() : placement.name())
+                << "\n";
+        }
+    }
+    csv.close();
+    return 0;
+}
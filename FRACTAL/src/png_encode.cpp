@@ -0,0 +1,118 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <omp.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/fractal.hpp"
+#include "../../common/placement.hpp"
+#include "../../common/png_writer.hpp"
+
+// Encoding throughput of writePNG against the P6 writer used elsewhere.
+// The image is rendered once; each run writes it to <dir>/mandelbrot.png
+// with 1, 2, 4, ... encoder threads. MB/s is measured on the raw RGB size.
+
+const int IterationMax = 500;
+const int MaxColorComponentValue = 255;
+
+using Clock = std::chrono::steady_clock;
+Placement placement = Placement::fromEnv();
+
+double seconds(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double>(to - from).count();
+}
+
+std::vector<unsigned char> renderImage(int size)
+{
+    Viewport view;
+    view.iXmax = view.iYmax = size;
+    EscapeTimeEngine<Mandelbrot> engine(view, IterationMax);
+    std::vector<unsigned char> color(size_t(size) * size * 3);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int iY = 0; iY < size; ++iY) {
+        std::vector<int> iterations(size);
+        engine.renderRow(iY, 0, size, iterations.data());
+        unsigned char* out = color.data() + size_t(iY) * size * 3;
+        for (int iX = 0; iX < size; ++iX) {
+            int it = iterations[iX];
+            if (it == IterationMax) {
+                out[3 * iX] = out[3 * iX + 1] = out[3 * iX + 2] = 0;
+            } else {
+                double t = std::sqrt(double(it) / IterationMax);
+                out[3 * iX] = (unsigned char)(MaxColorComponentValue * t);
+                out[3 * iX + 1] = (unsigned char)(MaxColorComponentValue * t * t);
+                out[3 * iX + 2] = (unsigned char)(MaxColorComponentValue * (1 - t));
+            }
+        }
+    }
+    return color;
+}
+
+double writePPM(const std::string& fileName, const std::vector<unsigned char>& color, int size)
+{
+    auto start = Clock::now();
+    FILE* fp = fopen(fileName.c_str(), "wb");
+    if (!fp)
+        return -1;
+    fprintf(fp, "P6\n%d %d\n%d\n", size, size, MaxColorComponentValue);
+    bool ok = fwrite(color.data(), 1, color.size(), fp) == color.size();
+    if (fclose(fp) != 0 || !ok)
+        return -1;
+    return seconds(start, Clock::now());
+}
+
+int main(int argc, char** argv)
+{
+    int size = argc > 1 ? atoi(argv[1]) : 8000;
+    int maxRun = argc > 2 ? atoi(argv[2]) : int(std::thread::hardware_concurrency());
+    std::string directory = argc > 3 ? argv[3] : "..";
+    // Pins the main thread too, which writes the PPM.
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+
+    std::vector<unsigned char> color = renderImage(size);
+    double rawMB = color.size() / 1e6;
+
+    std::string fileName("../png_encode.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "format,threads,size,bytes,time_seconds,mb_per_second,placement\n";
+
+    std::string ppm = directory + "/mandelbrot.ppm";
+    double time = writePPM(ppm, color, size);
+    if (time < 0) {
+        std::cerr << "cannot write " << ppm << "\n";
+        return 1;
+    }
+    size_t bytes = std::filesystem::file_size(ppm);
+    std::cout << "PPM, " << bytes / 1e6 << " MB, " << time << " s, " << rawMB / time << " MB/s\n";
+    csv << "PPM,1," << size << "," << bytes << "," << time << "," << rawMB / time << "," << placement.name() << "\n";
+    std::filesystem::remove(ppm);
+
+    std::string png = directory + "/mandelbrot.png";
+    for (int threads = 1; threads <= std::max(maxRun, 1); threads *= 2) {
+        auto start = Clock::now();
+        if (!writePNG(png, color.data(), size, size, 3, threads, &placement)) {
+            std::cerr << "cannot write " << png << "\n";
+            return 1;
+        }
+        time = seconds(start, Clock::now());
+        bytes = std::filesystem::file_size(png);
+        std::cout << "PNG, threads: " << threads << ", " << bytes / 1e6 << " MB, " << time << " s, "
+                  << rawMB / time << " MB/s\n";
+        csv << "PNG," << threads << "," << size << "," << bytes << "," << time << "," << rawMB / time << ","
+            << placement.name() << "\n";
+    }
+    csv.close();
+    return 0;
+}
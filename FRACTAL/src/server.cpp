@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../../common/fractal.hpp"
+#include "../../common/tile_cache.hpp"
+#include "../../common/worker_pool.hpp"
+
+// Long-running tile server. One epoll thread owns every socket; tile
+// renders run on a shared WorkerPool. Identical tiles requested while one
+// is already being rendered wait on that render instead of starting another.
+//
+//   GET /tile/z/x/y  - PGM image of the tile's iteration counts
+//   GET /stats       - recent latency percentiles and throughput so far
+
+const int IterationMax = 500;
+const int nr_threads = 8;
+const size_t queueCapacity = 256;
+const int maxZoom = 20;
+// Percentiles are over this many most recent requests.
+const size_t latencyWindow = 8192;
+// Unparsed request bytes a connection may buffer, headers included.
+const size_t maxRequestBytes = 16384;
+
+std::atomic<bool> running { true };
+
+struct Connection {
+    int fd = -1;
+    std::string in;
+    std::string out;
+    bool waiting = false;
+    bool closing = false; // close once out is sent
+    std::chrono::steady_clock::time_point requestStart;
+};
+
+struct Completion {
+    TileKey key;
+    TilePtr tile;
+    bool fromDisk;
+};
+
+class TileServer {
+public:
+    TileServer(int port, const std::string& diskDirectory)
+        : cache(size_t(512) << 20, diskDirectory)
+        , pyramid(cache, IterationMax)
+        , pool(nr_threads, queueCapacity, Placement::fromEnv())
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 1024) < 0) {
+            perror("bind");
+            exit(1);
+        }
+
+        epollFd = epoll_create1(0);
+        wakeFd = eventfd(0, EFD_NONBLOCK);
+        watch(listenFd, EPOLLIN, ListenId);
+        watch(wakeFd, EPOLLIN, WakeId);
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    ~TileServer()
+    {
+        // Render tasks write to wakeFd and the completion queue, so the
+        // workers must be gone before either is.
+        pool.stop();
+        for (auto& [id, c] : connections)
+            close(c.fd);
+        close(listenFd);
+        close(wakeFd);
+        close(epollFd);
+    }
+
+    void run()
+    {
+        std::vector<epoll_event> events(256);
+        while (running) {
+            int n = epoll_wait(epollFd, events.data(), int(events.size()), 500);
+            for (int i = 0; i < n; ++i) {
+                uint64_t id = events[i].data.u64;
+                if (id == ListenId)
+                    acceptAll();
+                else if (id == WakeId)
+                    drainCompletions();
+                else
+                    handleEvent(id, events[i].events);
+            }
+        }
+        std::cout << statsText();
+    }
+
+private:
+    static constexpr uint64_t ListenId = 0;
+    static constexpr uint64_t WakeId = 1;
+
+    TileCache cache;
+    TilePyramid<Mandelbrot> pyramid;
+
+    int listenFd;
+    int epollFd;
+    int wakeFd;
+    uint64_t nextId = 2;
+    std::unordered_map<uint64_t, Connection> connections;
+
+    // Renders in flight and the connections waiting for each of them.
+    std::unordered_map<TileKey, std::vector<uint64_t>, TileKeyHash> inFlight;
+
+    std::mutex completionMutex;
+    std::deque<Completion> completions;
+
+    // Declared after everything its tasks touch, so it is destroyed first.
+    WorkerPool pool;
+
+    // Ring of the last latencyWindow request latencies.
+    std::vector<double> latencies = std::vector<double>(latencyWindow);
+    long requests = 0;
+    long tilesServed = 0;
+    long rendered = 0;
+    long diskLoads = 0;
+    long coalesced = 0;
+    long rejected = 0;
+    std::chrono::steady_clock::time_point startTime;
+
+    void watch(int fd, uint32_t events, uint64_t id)
+    {
+        epoll_event ev {};
+        ev.events = events;
+        ev.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void rewatch(uint64_t id, Connection& c)
+    {
+        epoll_event ev {};
+        ev.events = EPOLLIN | EPOLLRDHUP | (c.out.empty() ? 0u : uint32_t(EPOLLOUT));
+        ev.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    void acceptAll()
+    {
+        for (;;) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+            if (fd < 0)
+                return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            uint64_t id = nextId++;
+            connections[id].fd = fd;
+            watch(fd, EPOLLIN | EPOLLRDHUP, id);
+        }
+    }
+
+    void closeConnection(uint64_t id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        connections.erase(it);
+    }
+
+    void handleEvent(uint64_t id, uint32_t events)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        Connection& c = it->second;
+
+        if (events & EPOLLIN) {
+            char buffer[4096];
+            for (;;) {
+                ssize_t n = read(c.fd, buffer, sizeof(buffer));
+                if (n > 0) {
+                    c.in.append(buffer, n);
+                    if (c.in.size() > maxRequestBytes)
+                        break;
+                } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    closeConnection(id);
+                    return;
+                } else {
+                    break;
+                }
+            }
+            parseRequests(id);
+            auto again = connections.find(id);
+            if (again != connections.end() && again->second.in.size() > maxRequestBytes) {
+                rejectOversized(id);
+                return;
+            }
+        }
+        if (events & (EPOLLHUP | EPOLLERR)) {
+            closeConnection(id);
+            return;
+        }
+        flush(id);
+    }
+
+    // A request line and headers that never end, or more pipelined requests
+    // than fit while a render is pending. The latter cannot be answered in
+    // order, so the connection is just closed.
+    void rejectOversized(uint64_t id)
+    {
+        Connection& c = connections.at(id);
+        c.in.clear();
+        if (c.waiting) {
+            closeConnection(id);
+            return;
+        }
+        c.closing = true;
+        c.requestStart = std::chrono::steady_clock::now();
+        respond(id, 431, "text/plain", "request too large\n");
+    }
+
+    // Requests on one connection are answered in order, so parsing stops
+    // while a tile render for this connection is still pending.
+    void parseRequests(uint64_t id)
+    {
+        for (;;) {
+            auto it = connections.find(id);
+            if (it == connections.end() || it->second.waiting || it->second.closing)
+                return;
+            Connection& c = it->second;
+            size_t end = c.in.find("\r\n\r\n");
+            if (end == std::string::npos)
+                return;
+            std::string requestLine = c.in.substr(0, c.in.find("\r\n"));
+            c.in.erase(0, end + 4);
+            c.requestStart = std::chrono::steady_clock::now();
+
+            std::istringstream line(requestLine);
+            std::string method, path;
+            line >> method >> path;
+
+            int z, x, y;
+            if (method != "GET") {
+                respond(id, 405, "text/plain", "method not allowed\n");
+            } else if (path == "/stats") {
+                respond(id, 200, "text/plain", statsText());
+            } else if (sscanf(path.c_str(), "/tile/%d/%d/%d", &z, &x, &y) == 3 && z >= 0 && z <= maxZoom
+                && x >= 0 && y >= 0 && x < (1 << z) && y < (1 << z)) {
+                requestTile(id, z, x, y);
+            } else {
+                respond(id, 404, "text/plain", "not found\n");
+            }
+        }
+    }
+
+    // Only the memory tier is looked up here; a disk read on this thread
+    // would stall every connection, so disk hits go through the pool too.
+    void requestTile(uint64_t id, int z, int x, int y)
+    {
+        TileKey key = pyramid.key(z, x, y);
+        if (TilePtr tile = cache.findMemory(key)) {
+            respondTile(id, *tile);
+            return;
+        }
+
+        auto pending = inFlight.find(key);
+        if (pending != inFlight.end()) {
+            pending->second.push_back(id);
+            connections.at(id).waiting = true;
+            ++coalesced;
+            return;
+        }
+
+        bool queued = pool.tryPush([this, key, z, x, y] {
+            TilePtr tile = cache.find(key);
+            bool fromDisk = tile != nullptr;
+            if (!tile) {
+                tile = pyramid.renderTile(z, x, y);
+                cache.insert(key, tile);
+            }
+            {
+                std::lock_guard<std::mutex> guard(completionMutex);
+                completions.push_back({ key, tile, fromDisk });
+            }
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        });
+        if (!queued) {
+            ++rejected;
+            respond(id, 503, "text/plain", "render queue full\n");
+            return;
+        }
+        inFlight[key].push_back(id);
+        connections.at(id).waiting = true;
+    }
+
+    void drainCompletions()
+    {
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+
+        std::deque<Completion> done;
+        {
+            std::lock_guard<std::mutex> guard(completionMutex);
+            done.swap(completions);
+        }
+        for (auto& completion : done) {
+            if (completion.fromDisk)
+                ++diskLoads;
+            else
+                ++rendered;
+            auto waiting = inFlight.find(completion.key);
+            if (waiting == inFlight.end())
+                continue;
+            std::vector<uint64_t> ids = std::move(waiting->second);
+            inFlight.erase(waiting);
+            for (uint64_t id : ids) {
+                auto it = connections.find(id);
+                if (it == connections.end())
+                    continue;
+                it->second.waiting = false;
+                respondTile(id, *completion.tile);
+                parseRequests(id);
+            }
+        }
+    }
+
+    void respondTile(uint64_t id, const Tile& tile)
+    {
+        std::string body = "P5\n" + std::to_string(TileSize) + " " + std::to_string(TileSize) + "\n255\n";
+        size_t header = body.size();
+        body.resize(header + TileSize * TileSize);
+        for (int i = 0; i < TileSize * TileSize; ++i) {
+            int it = tile.iterations[i];
+            body[header + i] = char(it == IterationMax ? 0 : 255 - (255 * it) / IterationMax);
+        }
+        ++tilesServed;
+        respond(id, 200, "image/x-portable-graymap", body);
+    }
+
+    static const char* statusReason(int status)
+    {
+        switch (status) {
+        case 200:
+            return "OK";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 431:
+            return "Request Header Fields Too Large";
+        default:
+            return "Service Unavailable";
+        }
+    }
+
+    void respond(uint64_t id, int status, const char* type, const std::string& body)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        Connection& c = it->second;
+        c.out += "HTTP/1.1 " + std::to_string(status) + " " + statusReason(status) + "\r\nContent-Type: " + type
+            + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        c.out += body;
+
+        auto elapsed = std::chrono::steady_clock::now() - c.requestStart;
+        latencies[requests++ % latencyWindow] = std::chrono::duration<double>(elapsed).count();
+        flush(id);
+    }
+
+    void flush(uint64_t id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        Connection& c = it->second;
+        while (!c.out.empty()) {
+            ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                c.out.erase(0, n);
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                closeConnection(id);
+                return;
+            }
+        }
+        if (c.closing && c.out.empty()) {
+            closeConnection(id);
+            return;
+        }
+        rewatch(id, c);
+    }
+
+    double percentile(std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+    }
+
+    std::string statsText()
+    {
+        std::vector<double> sorted(latencies.begin(), latencies.begin() + std::min(size_t(requests), latencyWindow));
+        std::sort(sorted.begin(), sorted.end());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::ostringstream out;
+        out << "requests: " << requests << "\n"
+            << "tiles: " << tilesServed << "\n"
+            << "rendered: " << rendered << "\n"
+            << "disk_loads: " << diskLoads << "\n"
+            << "coalesced: " << coalesced << "\n"
+            << "rejected: " << rejected << "\n"
+            << "queued: " << pool.queued() << "/" << pool.capacity() << "\n"
+            << "placement: " << pool.placementName() << "\n"
+            << "p50_ms: " << percentile(sorted, 0.50) * 1000 << "\n"
+            << "p99_ms: " << percentile(sorted, 0.99) * 1000 << "\n"
+            << "tiles_per_second: " << tilesServed / seconds << "\n";
+        return out.str();
+    }
+};
+
+int main(int argc, char** argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 8080;
+    std::string diskDirectory = argc > 2 ? argv[2] : "";
+
+    signal(SIGINT, [](int) { running = false; });
+    signal(SIGTERM, [](int) { running = false; });
+
+    TileServer server(port, diskDirectory);
+    std::cout << "Serving tiles on 127.0.0.1:" << port << std::endl;
+    server.run();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+#include "../../common/fractal.hpp"
+#include "../../common/placement.hpp"
+#include "../../common/precision.hpp"
+#include "../../common/tile_cache.hpp"
+
+const int viewWidth = 1920;
+const int viewHeight = 1080;
+const int zoomLevel = 5;
+const int panStep = 96;
+const int frames = 24;
+const int IterationMax = 500;
+const int nr_threads = 8;
+// Both paths render at this tier, so the comparison is only about reuse.
+const PrecisionTier Tier = PrecisionTier::Double;
+Placement placement = Placement::fromEnv();
+
+// Renders the same panning sequence, starting at (startX, startY), with and
+// without the tile cache. A pan shifts the window by less than a tile, so
+// most tiles of the next frame are already cached.
+template <typename Func>
+void runExperiment(const std::string& name, Func func, TileCache* cache, std::ofstream& csv, long startX = 2000,
+    long startY = 2600)
+{
+    std::vector<int> iterations(long(viewWidth) * viewHeight);
+    double total = 0;
+
+    for (int frame = 0; frame < frames; ++frame) {
+        long px0 = startX + long(frame) * panStep;
+        long py0 = startY + long(frame) * panStep / 2;
+
+        if (cache)
+            cache->resetStats();
+        double start = omp_get_wtime();
+        func(px0, py0, iterations.data());
+        double end = omp_get_wtime();
+        total += end - start;
+
+        csv << name << "," << nr_threads << "," << frame << "," << end - start;
+        if (cache)
+            csv << "," << cache->memoryHits() << "," << cache->diskHits() << "," << cache->misses();
+        else
+            csv << ",0,0,0";
+        csv << "," << placement.name() << "\n";
+    }
+    std::cout << name << ": " << total / frames << " s per frame\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string fileName("../tile_cache.csv");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream csv(fileName, std::ios::app);
+    if (newFile)
+        csv << "method,threads,frame,time_seconds,memory_hits,disk_hits,misses,placement\n";
+
+    omp_set_num_threads(nr_threads);
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+    std::string diskDirectory = argc > 1 ? argv[1] : "";
+
+    TileCache cache(size_t(128) << 20, diskDirectory);
+    TilePyramid<Mandelbrot> pyramid(cache, IterationMax, Tier);
+
+    // Full-frame render of the same pixel grid, no reuse between frames.
+    runExperiment(
+        "Uncached",
+        [&](long px0, long py0, int* out) {
+            DeepViewport view = pyramid.windowViewport(zoomLevel, px0, py0, viewWidth, viewHeight);
+            withPrecision(Tier, view, IterationMax, 2, Mandelbrot(), [&](const auto& engine) {
+#pragma omp parallel for schedule(dynamic)
+                for (int iY = 0; iY < viewHeight; ++iY)
+                    engine.renderRow(iY, 0, viewWidth, out + long(iY) * viewWidth);
+            });
+        },
+        nullptr, csv);
+
+    runExperiment(
+        diskDirectory.empty() ? "Cached" : "CachedDisk",
+        [&](long px0, long py0, int* out) { pyramid.render(zoomLevel, px0, py0, viewWidth, viewHeight, out); },
+        &cache, csv);
+
+    // Pans in from left of and above the pyramid: the first frames lie
+    // entirely outside it, the rest straddle the origin.
+    runExperiment(
+        "CachedEdge",
+        [&](long px0, long py0, int* out) { pyramid.render(zoomLevel, px0, py0, viewWidth, viewHeight, out); },
+        &cache, csv, -viewWidth - 300, -viewHeight / 2);
+
+    csv.close();
+    return 0;
+}
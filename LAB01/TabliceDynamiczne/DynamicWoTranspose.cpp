@@ -6,12 +6,16 @@
 #include <thread>
 #include <vector>
 
+#include "../../common/huge_buffer.hpp"
+#include "../../common/placement.hpp"
+
 // This function will be called from a thread
 int N = 8 * 128;
 int nr_threads = 2; // Założenie: N dzieli się przez nr_threads
+Placement placement = Placement::fromEnv();
 
 double **A, **B, **C;
-double *_a, *_b, *_c;
+HugeBuffer<double> _a, _b, _c;
 
 void func(int tid) {
   int i, j, k;
@@ -28,17 +32,17 @@ void func(int tid) {
   }
 }
 
-void allocMatix(double **&m, double *&b) {
+void allocMatix(double **&m, HugeBuffer<double> &b) {
   m = new double *[N];
-  b = new double[N * N];
+  b = HugeBuffer<double>(size_t(N) * N, nr_threads);
   for (int i = 0; i < N; ++i) {
-    m[i] = b + i * N;
+    m[i] = b.data() + i * N;
   }
 }
 
-void deleteMatrix(double **&m, double *&b) {
+void deleteMatrix(double **&m, HugeBuffer<double> &b) {
   delete[] m;
-  delete[] b;
+  b.reset();
 }
 int main(int argc, char **argv) {
 
@@ -57,6 +61,8 @@ int main(int argc, char **argv) {
   // Launch a group of threads
   for (int i = 0; i < nr_threads; ++i) {
     th.push_back(std::thread(func, i));
+    if (!placement.pinThread(th.back().native_handle(), i))
+      placement.markUnpinned();
   }
 
   // Join the threads with the main thread
@@ -67,6 +73,7 @@ int main(int argc, char **argv) {
   const std::chrono::duration<double> elapsed_seconds{finish - start};
   std::cout << elapsed_seconds.count()
             << '\n'; // C++20's chrono::duration operator<<
+  std::cout << "Pages: " << _c.describe() << '\n';
 
   deleteMatrix(A, _a);
   deleteMatrix(B, _b);
@@ -74,8 +81,8 @@ int main(int argc, char **argv) {
 
   std::ofstream myFile("TabliceDynamiczne.csv", std::ios_base::app);
 
-  myFile << nr_threads << ", " << N << ", " << elapsed_seconds.count()
-         << std::endl;
+  myFile << nr_threads << ", " << N << ", " << elapsed_seconds.count() << ", "
+         << placement.name() << std::endl;
 
   myFile.close();
   return 0;
@@ -5,7 +5,10 @@
 #include <thread>
 #include <vector>
 
+#include "../../common/placement.hpp"
+
 int nr_threads = 1;
+Placement placement = Placement::fromEnv();
 const int N = 2400;
 
 double A[N][N], B[N][N], C[N][N], BT[N][N];
@@ -40,6 +43,8 @@ int main(int argv, char **argc) {
 
   for (int i = 0; i < nr_threads; ++i) {
     threads.push_back(std::thread(func, i));
+    if (!placement.pinThread(threads.back().native_handle(), i))
+      placement.markUnpinned();
   }
 
   for (auto &t : threads) {
@@ -51,8 +56,8 @@ int main(int argv, char **argc) {
 
   std::ofstream myFile("TabliceStatyczneT.csv", std::ios_base::app);
 
-  myFile << nr_threads << ", " << N << ", " << elapsed_seconds.count()
-         << std::endl;
+  myFile << nr_threads << ", " << N << ", " << elapsed_seconds.count() << ", "
+         << placement.name() << std::endl;
 
   myFile.close();
   return 0;
@@ -6,9 +6,16 @@
 #include <math.h>
 #include <mutex>
 #include <stdio.h>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "../common/fractal.hpp"
+#include "../common/huge_buffer.hpp"
+#include "../common/metrics.hpp"
+#include "../common/placement.hpp"
+#include "../common/png_writer.hpp"
+
 const int iXmax = 20000;
 const int iYmax = 20000;
 const double CxMin = -2.5;
@@ -20,15 +27,20 @@ const int IterationMax = 500;
 const double EscapeRadius = 2;
 const int nr_threads = 16;
 
-unsigned char color[iYmax][iXmax][3];
-long int sum[nr_threads] = { 0 };
-double threadExecTime[nr_threads] = { 0 };
+// iYmax * iXmax * 3 bytes, too large for 4 KiB pages to stay in the TLB.
+HugeBuffer<unsigned char> colorBuffer;
+unsigned char (*color)[iXmax][3] = nullptr;
+ThreadMetrics metrics(nr_threads);
 std::mutex mtx;
 int counter = 0;
+Placement placement = Placement::fromEnv();
 
-void mandelbrotThread(int tid, unsigned char* threadColor);
-void mandelbrotThreadDynamic(int tid, unsigned char* threadColor);
-void mandelbrotThreadMutex(int tid, unsigned char* threadColor);
+template <class Engine>
+void mandelbrotThread(const Engine& engine, int tid, unsigned char* threadColor);
+template <class Engine>
+void mandelbrotThreadDynamic(const Engine& engine, int tid, unsigned char* threadColor);
+template <class Engine>
+void mandelbrotThreadMutex(const Engine& engine, int tid, unsigned char* threadColor);
 
 template <typename Func>
 double runExperiment(const std::string& name, Func func, int runs,
@@ -36,8 +48,7 @@ double runExperiment(const std::string& name, Func func, int runs,
 {
     double avgTime = 0;
     for (int r = 1; r <= runs; ++r) {
-        for (int i = 0; i < nr_threads; i++)
-            sum[i] = 0;
+        metrics.reset();
         counter = 0;
 
         auto start = std::chrono::steady_clock::now();
@@ -48,6 +59,8 @@ double runExperiment(const std::string& name, Func func, int runs,
             threadColor[i][1] = 255 - threadColor[i][0];
             threadColor[i][2] = 0;
             threads.emplace_back(func, i, threadColor[i]);
+            if (!placement.pinThread(threads.back().native_handle(), i))
+                placement.markUnpinned();
         }
         for (auto& t : threads)
             t.join();
@@ -55,183 +68,136 @@ double runExperiment(const std::string& name, Func func, int runs,
 
         avgTime += std::chrono::duration<double>(end - start).count();
     }
-    csv << name << "," << nr_threads << "," << avgTime / runs << "\n";
-    std::cout << name << ": " << avgTime / runs << " s\n";
-    for (int tid = 0; tid < nr_threads; ++tid) {
-        std::cout << "Thread " << tid << ": " << threadExecTime[tid] << " s"
-                  << std::endl;
-    }
+    csv << name << "," << nr_threads << "," << avgTime / runs << "," << placement.name() << "\n";
+    std::cout << name << " (" << placement.name() << "): " << avgTime / runs << " s\n";
+    metrics.print(std::cout);
     std::cout << std::endl;
 
     /**
-  FILE *fp;
-  char *comment = "# ";
-  fp = fopen((name + ".ppm").c_str(), "wb");
-  fprintf(fp, "P6\n %s\n %d\n %d\n %d\n", comment, iXmax, iYmax,
-          MaxColorComponentValue);
-  for (int y = 0; y < iYmax; ++y) {
-    for (int x = 0; x < iXmax; ++x) {
-      fwrite(color[y][x], 1, 3, fp);
-    }
-  }
+    writePNG(name + ".png", colorBuffer.data(), iXmax, iYmax, 3, nr_threads);
     **/
     return 0;
 }
 
-int main()
+template <class Formula>
+void runFormula(const Formula& formula, std::ofstream& csv)
+{
+    Viewport view { CxMin, CxMax, CyMin, CyMax, iXmax, iYmax };
+    EscapeTimeEngine<Formula> engine(view, IterationMax, EscapeRadius, formula);
+    std::string prefix = std::string(Formula::name()) == "Mandelbrot" ? "" : Formula::name();
+
+    // runExperiment(prefix + "Block", [&](int tid, unsigned char* c) { mandelbrotThread(engine, tid, c); }, 3, csv);
+    // runExperiment(prefix + "Dynamic", [&](int tid, unsigned char* c) { mandelbrotThreadDynamic(engine, tid, c); }, 3, csv);
+    runExperiment(
+        prefix + "Mutex", [&](int tid, unsigned char* c) { mandelbrotThreadMutex(engine, tid, c); }, 3, csv);
+}
+
+int main(int argc, char** argv)
 {
     bool newFile = !std::filesystem::exists("mandelbrot_times_pc.csv");
     std::ofstream csv("mandelbrot_times_pc.csv", std::ios::app);
     if (newFile)
-        csv << "method,threads,run,time_seconds\n";
-
-    // runExperiment("Block", mandelbrotThreadBlock, 3, csv);
-    // runExperiment("Dynamic", mandelbrotThreadDynamic, 3, csv);
-    runExperiment("Mutex", mandelbrotThreadMutex, 3, csv);
+        csv << "method,threads,time_seconds,placement\n";
+
+    colorBuffer = HugeBuffer<unsigned char>(size_t(iYmax) * iXmax * 3, nr_threads);
+    color = reinterpret_cast<unsigned char(*)[iXmax][3]>(colorBuffer.data());
+    std::cout << "Color buffer: " << colorBuffer.describe() << std::endl;
+
+    // Same formula names as LAB04; the thread functions are compiled per formula.
+    std::string formula = argc > 1 ? argv[1] : "mandelbrot";
+    if (formula == "julia")
+        runFormula(Julia(), csv);
+    else if (formula == "burningship")
+        runFormula(BurningShip(), csv);
+    else if (formula == "tricorn")
+        runFormula(Tricorn(), csv);
+    else if (formula == "multibrot3")
+        runFormula(Multibrot<3>(), csv);
+    else if (formula == "multibrot4")
+        runFormula(Multibrot<4>(), csv);
+    else
+        runFormula(Mandelbrot(), csv);
 
     csv.close();
     return 0;
 }
 
-void mandelbrotThread(int tid, unsigned char* threadColor)
+void colorRow(int iY, const int* iterations, const unsigned char* threadColor)
+{
+    for (int iX = 0; iX < iXmax; iX++) {
+        if (iterations[iX] == IterationMax) {
+            color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
+        } else {
+            color[iY][iX][0] = threadColor[0];
+            color[iY][iX][1] = threadColor[1];
+            color[iY][iX][2] = threadColor[2];
+        }
+    }
+}
+
+template <class Engine>
+void mandelbrotThread(const Engine& engine, int tid, unsigned char* threadColor)
 {
     auto start = std::chrono::steady_clock::now();
     int lowerBound = (iYmax / nr_threads) * tid;
     int upperBound = lowerBound + (iYmax / nr_threads);
 
-    int iX, iY, Iteration;
-    double Cx, Cy;
-    double PixelWidth = (CxMax - CxMin) / iXmax;
-    double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
-    double ER2 = EscapeRadius * EscapeRadius;
-
-    for (iY = lowerBound; iY < upperBound; ++iY) {
-        Cy = CyMin + iY * PixelHeight;
-        if (fabs(Cy) < PixelHeight / 2)
-            Cy = 0.0;
-
-        for (iX = 0; iX < iXmax; iX++) {
-            Cx = CxMin + iX * PixelWidth;
-            Zx = Zy = 0.0;
-            Zx2 = Zy2 = 0.0;
-
-            for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                Iteration++) {
-                Zy = 2 * Zx * Zy + Cy;
-                Zx = Zx2 - Zy2 + Cx;
-                Zx2 = Zx * Zx;
-                Zy2 = Zy * Zy;
-            }
-            sum[tid] += Iteration;
-
-            if (Iteration == IterationMax) {
-                color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-            } else {
-                color[iY][iX][0] = threadColor[0];
-                color[iY][iX][1] = threadColor[1];
-                color[iY][iX][2] = threadColor[2];
-            }
-        }
+    std::vector<int> iterations(iXmax);
+    MetricsSlot local;
+    for (int iY = lowerBound; iY < upperBound; ++iY) {
+        local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+        local.add(Pixels, iXmax);
+        local.add(Chunks);
+        colorRow(iY, iterations.data(), threadColor);
     }
     auto end = std::chrono::steady_clock::now();
-    threadExecTime[tid] = (end - start).count();
+    local.addTime(ExecTime, std::chrono::duration<double>(end - start).count());
+    metrics.merge(tid, local);
 }
-void mandelbrotThreadDynamic(int tid, unsigned char* threadColor)
+
+template <class Engine>
+void mandelbrotThreadDynamic(const Engine& engine, int tid, unsigned char* threadColor)
 {
     auto start = std::chrono::steady_clock::now();
-    int lowerBound = (iYmax / nr_threads) * tid;
-    int upperBound = lowerBound + (iYmax / nr_threads);
 
-    int iX, iY, Iteration;
-    double Cx, Cy;
-    double PixelWidth = (CxMax - CxMin) / iXmax;
-    double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
-    double ER2 = EscapeRadius * EscapeRadius;
-
-    for (iY = tid; iY < iYmax; iY += nr_threads) {
-        Cy = CyMin + iY * PixelHeight;
-        if (fabs(Cy) < PixelHeight / 2)
-            Cy = 0.0;
-
-        for (iX = 0; iX < iXmax; iX++) {
-            Cx = CxMin + iX * PixelWidth;
-            Zx = Zy = 0.0;
-            Zx2 = Zy2 = 0.0;
-
-            for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                Iteration++) {
-                Zy = 2 * Zx * Zy + Cy;
-                Zx = Zx2 - Zy2 + Cx;
-                Zx2 = Zx * Zx;
-                Zy2 = Zy * Zy;
-            }
-            sum[tid] += Iteration;
-
-            if (Iteration == IterationMax) {
-                color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-            } else {
-                color[iY][iX][0] = threadColor[0];
-                color[iY][iX][1] = threadColor[1];
-                color[iY][iX][2] = threadColor[2];
-            }
-        }
+    std::vector<int> iterations(iXmax);
+    MetricsSlot local;
+    for (int iY = tid; iY < iYmax; iY += nr_threads) {
+        local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+        local.add(Pixels, iXmax);
+        local.add(Chunks);
+        colorRow(iY, iterations.data(), threadColor);
     }
     auto end = std::chrono::steady_clock::now();
-    threadExecTime[tid] = (end - start).count();
+    local.addTime(ExecTime, std::chrono::duration<double>(end - start).count());
+    metrics.merge(tid, local);
 }
 
-void mandelbrotThreadMutex(int tid, unsigned char* threadColor)
+template <class Engine>
+void mandelbrotThreadMutex(const Engine& engine, int tid, unsigned char* threadColor)
 {
     auto start = std::chrono::steady_clock::now();
-    int lowerBound = (iYmax / nr_threads) * tid;
-    int upperBound = lowerBound + (iYmax / nr_threads);
-
-    int iX, iY, Iteration;
-    double Cx, Cy;
-    double PixelWidth = (CxMax - CxMin) / iXmax;
-    double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
-    double ER2 = EscapeRadius * EscapeRadius;
 
+    std::vector<int> iterations(iXmax);
+    MetricsSlot local;
     int myID = 0;
 
     while (myID < iYmax) {
+        auto waitStart = std::chrono::steady_clock::now();
         mtx.lock();
+        local.addTime(WaitTime, std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count());
         myID = counter++;
         mtx.unlock();
 
-        iY = myID;
+        int iY = myID;
         if (iY < iYmax) {
-            Cy = CyMin + iY * PixelHeight;
-            if (fabs(Cy) < PixelHeight / 2)
-                Cy = 0.0;
-
-            for (iX = 0; iX < iXmax; iX++) {
-                Cx = CxMin + iX * PixelWidth;
-                Zx = Zy = 0.0;
-                Zx2 = Zy2 = 0.0;
-
-                for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                    Iteration++) {
-                    Zy = 2 * Zx * Zy + Cy;
-                    Zx = Zx2 - Zy2 + Cx;
-                    Zx2 = Zx * Zx;
-                    Zy2 = Zy * Zy;
-                }
-                sum[tid] += Iteration;
-
-                if (Iteration == IterationMax) {
-                    color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-                } else {
-                    color[iY][iX][0] = threadColor[0];
-                    color[iY][iX][1] = threadColor[1];
-                    color[iY][iX][2] = threadColor[2];
-                }
-            }
+            local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+            local.add(Pixels, iXmax);
+            local.add(Chunks);
+            colorRow(iY, iterations.data(), threadColor);
         }
     }
     auto end = std::chrono::steady_clock::now();
-    threadExecTime[tid] = (end - start).count();
+    local.addTime(ExecTime, std::chrono::duration<double>(end - start).count());
+    metrics.merge(tid, local);
 }
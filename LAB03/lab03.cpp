@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -9,6 +10,9 @@
 #include <thread>
 #include <vector>
 
+#include "../common/placement.hpp"
+#include "../common/png_writer.hpp"
+
 enum Direction {
     up = 1,
     down = 2,
@@ -18,6 +22,8 @@ enum Direction {
 };
 
 std::mutex coutMutex;
+Placement placement = Placement::fromEnv();
+std::atomic<bool> pinFailed { false };
 
 struct Position {
     Position()
@@ -120,6 +126,7 @@ public:
     void run();
 
     void saveToPPM(const std::string&, const int);
+    void saveToPNG(const std::string&, const int);
 
 private:
     std::vector<std::vector<int>> mazeMatrix;
@@ -142,6 +149,7 @@ private:
     void clear();
 
     void generateDFS(int x, int y);
+    void cellColor(int, unsigned char[3]) const;
 };
 
 Maze::~Maze()
@@ -267,18 +275,10 @@ void Maze::saveToPPM(const std::string& fileName, const int scale = 1)
     for (const auto& row : mazeMatrix) {
         for (int i = 0; i < scale; ++i) {
             for (const auto& cell : row) {
-                unsigned r, g, b;
-                if (cell == 0) {
-                    r = g = b = 255;
-                } else if (cell > 0) {
-                    r = (255 / threadCounter) * (cell - 1);
-                    g = 255 - r;
-                    b = 0;
-                } else {
-                    r = g = b = 0;
-                }
+                unsigned char rgb[3];
+                cellColor(cell, rgb);
                 for (int j = 0; j < scale; ++j)
-                    file << r << " " << g << " " << b << " ";
+                    file << unsigned(rgb[0]) << " " << unsigned(rgb[1]) << " " << unsigned(rgb[2]) << " ";
             }
             file << "\n";
         }
@@ -287,8 +287,41 @@ void Maze::saveToPPM(const std::string& fileName, const int scale = 1)
     file.close();
 }
 
+void Maze::saveToPNG(const std::string& fileName, const int scale = 1)
+{
+    const int height = int(mazeMatrix.size()) * scale;
+    const int width = int(mazeMatrix[0].size()) * scale;
+
+    writePNGRows(fileName, width, height, 3, [&](int y, unsigned char* out) {
+        const auto& row = mazeMatrix[y / scale];
+        for (size_t x = 0; x < row.size(); ++x) {
+            cellColor(row[x], out);
+            for (int j = 1; j < scale; ++j)
+                std::copy(out, out + 3, out + 3 * j);
+            out += 3 * scale;
+        }
+    });
+}
+
+void Maze::cellColor(int cell, unsigned char rgb[3]) const
+{
+    if (cell == 0) {
+        rgb[0] = rgb[1] = rgb[2] = 255;
+    } else if (cell > 0) {
+        unsigned r = (255 / threadCounter) * (cell - 1);
+        rgb[0] = (unsigned char)r;
+        rgb[1] = (unsigned char)(255 - r);
+        rgb[2] = 0;
+    } else {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+    }
+}
+
 void Maze::threadTraverse(const int tid, const Position& startingPos)
 {
+    // Thread ids start at 1 and grow with every branch of the maze.
+    if (!placement.pinCurrentThread(tid - 1))
+        pinFailed = true;
     Position currentPos(startingPos);
     bool moved = true;
 
@@ -383,11 +416,15 @@ void Maze::clear()
 
 int main()
 {
+    std::cout << "Placement: " << placement.name() << std::endl;
+
     Maze maze;
     maze.generateMaze(40, 40);
     maze.run();
+    if (pinFailed)
+        placement.markUnpinned();
     maze.printBoard();
-    maze.saveToPPM("maze.ppm", 16);
+    maze.saveToPNG("maze.png", 16);
 
     return 0;
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <ios>
@@ -5,6 +7,15 @@
 #include <math.h>
 #include <omp.h>
 #include <stdio.h>
+#include <vector>
+
+#include "../../common/autotune.hpp"
+#include "../../common/fractal.hpp"
+#include "../../common/huge_buffer.hpp"
+#include "../../common/metrics.hpp"
+#include "../../common/placement.hpp"
+#include "../../common/png_writer.hpp"
+#include "../../common/precision.hpp"
 
 const int iXmax = 10000;
 const int iYmax = 10000;
@@ -16,101 +27,264 @@ const int MaxColorComponentValue = 255;
 const int IterationMax = 500;
 const double EscapeRadius = 2;
 const int nr_threads = 8;
-
-unsigned char color[iYmax][iXmax][3];
-
-long int sum[nr_threads] = { 0 };
-double threadExecTime[nr_threads] = { 0 };
+const int maxBlockSize = 256;
+const int blockJump = 2;
+
+// Tile shape and taskloop grainsize for the 2D variants, overridable with
+// TILE=<width>x<height> and GRAINSIZE=<tiles>. Their schedule is taken
+// from OMP_SCHEDULE.
+struct TileShape {
+    int width;
+    int height;
+};
+
+// iYmax * iXmax * 3 bytes, too large for 4 KiB pages to stay in the TLB.
+HugeBuffer<unsigned char> colorBuffer;
+unsigned char (*color)[iXmax][3] = nullptr;
+
+ThreadMetrics metrics(nr_threads);
 int counter = 0;
+Placement placement = Placement::fromEnv();
+PrecisionTier precision = PrecisionTier::Double;
+
+template <class Engine>
+void mandelbrotThreadGuided(const Engine& engine, int blockSize);
+template <class Engine>
+void mandelbrotThreadStatic(const Engine& engine, int blockSize);
+template <class Engine>
+void mandelbrotThreadDynamic(const Engine& engine, int blockSize);
+template <class Engine>
+void mandelbrotThreadRuntime(const Engine& engine);
+template <class Engine>
+void mandelbrotTilesCollapse(const Engine& engine, TileShape tile);
+template <class Engine>
+void mandelbrotTaskloop(const Engine& engine, TileShape tile, int grainsize);
+
+TileShape tileShapeFromEnv()
+{
+    TileShape tile { 64, 64 };
+    const char* env = std::getenv("TILE");
+    if (env && sscanf(env, "%dx%d", &tile.width, &tile.height) != 2)
+        tile = { 64, 64 };
+    tile.width = std::max(1, std::min(tile.width, iXmax));
+    tile.height = std::max(1, std::min(tile.height, iYmax));
+    return tile;
+}
+
+int grainsizeFromEnv()
+{
+    const char* env = std::getenv("GRAINSIZE");
+    return env ? std::max(1, atoi(env)) : 4;
+}
 
-void mandelbrotThreadGuided(int blockSize);
-void mandelbrotThreadStatic(int blockSize);
-void mandelbrotThreadDynamic(int blockSize);
+// Name and chunk of the schedule(runtime) setting, i.e. OMP_SCHEDULE.
+std::string runtimeSchedule(int& chunk)
+{
+    omp_sched_t kind;
+    omp_get_schedule(&kind, &chunk);
+    chunk = std::max(chunk, 1);
+    switch (int(kind) & ~int(omp_sched_monotonic)) {
+    case omp_sched_static:
+        return "static";
+    case omp_sched_dynamic:
+        return "dynamic";
+    case omp_sched_guided:
+        return "guided";
+    default:
+        return "auto";
+    }
+}
 
 template <typename Func>
-double runExperiment(const std::string& name, Func func, int runs,
+double timeRender(const std::string& name, int blockSize, Func func, int runs,
     std::ofstream& csv)
 {
     double avgTime = 0;
-    for (int r = 1; r <= runs; ++r) {
-        for (int i = 0; i < nr_threads; i++)
-            sum[i] = 0;
+    for (int i = 0; i < runs; ++i) {
         counter = 0;
+        metrics.reset();
+        auto start = omp_get_wtime();
+        func(blockSize);
+        auto end = omp_get_wtime();
+
+        avgTime += end - start;
     }
+    avgTime /= runs;
+    std::cout << name << ": " << avgTime << " s\n";
+    metrics.print(std::cout);
+    std::cout << std::endl;
+
+    csv << name << "," << nr_threads << "," << iXmax << "," << blockSize << "," << avgTime << "," << placement.name() << ","
+        << tierName(precision) << "\n";
+    return avgTime;
+}
 
-    int maxBlockSize = 1;
-    int blockJump = 2;
+template <typename Func>
+double runExperiment(const std::string& name, Func func, int runs,
+    std::ofstream& csv)
+{
     for (int j = 1; j <= maxBlockSize; j *= blockJump) {
         std::cout << "Size " << j << std::endl;
-        for (int i = 0; i < runs; ++i) {
-
-            auto start = omp_get_wtime();
-            func(j);
-            auto end = omp_get_wtime();
-
-            avgTime += end - start;
-        }
-        avgTime /= runs;
-        std::cout << name << ": " << avgTime << " s\n";
-        for (int tid = 0; tid < nr_threads; ++tid) {
-            std::cout << "Thread " << tid << " iterations executed: " << sum[tid]
-                      << ", execution time: " << threadExecTime[tid]
-                      << std::endl;
-        }
-        std::cout << std::endl;
-
-        csv << name << "," << nr_threads << "," << iXmax << "," << j << "," << avgTime << "\n";
+        timeRender(name, j, func, runs, csv);
     }
 
     /**
-    FILE* fp;
-    char* comment = "# ";
-    fp = fopen((name + std::to_string(nr_threads) + ".ppm").c_str(), "wb");
-    fprintf(fp, "P6\n %s\n %d\n %d\n %d\n", comment, iXmax, iYmax,
-        MaxColorComponentValue);
-
-    for (int y = 0; y < iYmax; ++y) {
-        for (int x = 0; x < iXmax; ++x) {
-            fwrite(color[y][x], 1, 3, fp);
-        }
-    }
-    fclose(fp);
+    writePNG(name + std::to_string(nr_threads) + ".png", colorBuffer.data(), iXmax, iYmax, 3, nr_threads);
     **/
     return 0;
 }
 
-int main()
+// Renders frames with schedule(runtime), letting an AutoTuner pick the
+// schedule, chunk and thread count per frame. Only frames rendered with
+// the locked-in configuration go to the CSV.
+template <class Engine>
+void runTuned(const Engine& engine, const std::string& workload, int frames, std::ofstream& csv)
+{
+    std::vector<TuneConfig> candidates;
+    for (const char* schedule : { "static", "dynamic", "guided" })
+        for (int chunk : { 1, 8, 64 })
+            for (int threads : { nr_threads / 2, nr_threads })
+                candidates.push_back({ schedule, chunk, threads });
+
+    AutoTuner tuner(workload, iXmax, candidates, "../autotune.db");
+    if (tuner.fromDatabase())
+        std::cout << "Tuned from database: " << tuner.current().name() << std::endl;
+
+    for (int frame = 0; frame < frames; ++frame) {
+        TuneConfig config = tuner.current();
+        bool tuned = tuner.locked();
+        applyOpenMP(config);
+        if (!placement.pinOpenMP())
+            placement.markUnpinned();
+
+        metrics.reset();
+        double start = omp_get_wtime();
+        mandelbrotThreadRuntime(engine);
+        double seconds = omp_get_wtime() - start;
+        tuner.report(seconds);
+
+        std::cout << "Frame " << frame << (tuned ? ", tuned " : ", exploring ") << config.name() << ": " << seconds
+                  << " s (" << tuner.remaining() << " candidates left)\n";
+        if (tuned)
+            csv << "Tuned-" << config.schedule << "," << config.threads << "," << iXmax << "," << config.chunk << ","
+                << seconds << "," << placement.name() << "," << tierName(precision) << "\n";
+    }
+    std::cout << "Best: " << tuner.best().name() << std::endl;
+    omp_set_num_threads(nr_threads);
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+}
+
+template <class Formula>
+void runFormula(const Formula& formula, const DeepViewport& view, const std::string& tierArg,
+    const std::string& mode, int frames, std::ofstream& csv)
+{
+    std::string prefix = std::string(Formula::name()) == "Mandelbrot" ? "" : Formula::name();
+
+    // Double unless asked otherwise, so the schedule comparisons do not
+    // change scalar type when the view does.
+    PrecisionTier tier = PrecisionTier::Double;
+    if (tierArg == "auto")
+        tier = selectPrecision(view);
+    else if (tierArg == "float")
+        tier = PrecisionTier::Float;
+    else if (tierArg == "deep")
+        tier = PrecisionTier::Deep;
+    precision = tier;
+    std::cout << Formula::name() << ", precision: " << tierName(tier) << std::endl;
+
+    int chunk;
+    std::string schedule = runtimeSchedule(chunk);
+    TileShape tile = tileShapeFromEnv();
+    std::string shape = std::to_string(tile.width) + "x" + std::to_string(tile.height);
+
+    withPrecision(tier, view, IterationMax, EscapeRadius, formula, [&](const auto& engine) {
+        if (mode == "all" || mode == "rows") {
+            runExperiment(prefix + "Guided", [&](int b) { mandelbrotThreadGuided(engine, b); }, 1, csv);
+            runExperiment(prefix + "Static", [&](int b) { mandelbrotThreadStatic(engine, b); }, 1, csv);
+            runExperiment(prefix + "Dynamic", [&](int b) { mandelbrotThreadDynamic(engine, b); }, 1, csv);
+        }
+        if (mode == "all" || mode == "runtime") {
+            timeRender(prefix + "Runtime-" + schedule, chunk, [&](int) { mandelbrotThreadRuntime(engine); }, 1, csv);
+            timeRender(prefix + "Tiles" + shape + "-" + schedule, chunk,
+                [&](int) { mandelbrotTilesCollapse(engine, tile); }, 1, csv);
+            timeRender(prefix + "Taskloop" + shape, grainsizeFromEnv(),
+                [&](int g) { mandelbrotTaskloop(engine, tile, g); }, 1, csv);
+        }
+        if (mode == "tune")
+            runTuned(engine, std::string("LAB04-") + Formula::name() + "-" + tierName(tier), frames, csv);
+    });
+}
+
+int main(int argc, char** argv)
 {
     std::string fileName("../mandelbrot_times_pc_sizes.csv");
     bool newFile = !std::filesystem::exists(fileName);
     std::ofstream csv(fileName, std::ios::app);
     if (newFile)
-        csv << "method,threads,size,blockSize,time_seconds\n";
+        csv << "method,threads,size,blockSize,time_seconds,placement,precision\n";
 
     omp_set_num_threads(nr_threads);
-
-    runExperiment("Guided", mandelbrotThreadGuided, 1, csv);
-    runExperiment("Static", mandelbrotThreadStatic, 1, csv);
-    runExperiment("Dynamic", mandelbrotThreadGuided, 1, csv);
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+    std::cout << "Placement: " << placement.name() << std::endl;
+    colorBuffer = HugeBuffer<unsigned char>(size_t(iYmax) * iXmax * 3, nr_threads);
+    color = reinterpret_cast<unsigned char(*)[iXmax][3]>(colorBuffer.data());
+    std::cout << "Color buffer: " << colorBuffer.describe() << std::endl;
+
+    // The formula and precision are picked once here; everything below is
+    // compiled per formula and scalar type.
+    std::string formula = argc > 1 ? argv[1] : "mandelbrot";
+    std::string tier = argc > 2 ? argv[2] : "double";
+    // rows: the schedule(kind, blockSize) sweep over rows; runtime: the
+    // OMP_SCHEDULE row, collapsed tile and taskloop variants; tune: frames
+    // under the auto-tuner, not part of "all".
+    std::string mode = argc > 3 ? argv[3] : "all";
+    int frames = argc > 4 ? atoi(argv[4]) : 40;
+    // Centre as text, parsed to double-double so the deep tier can zoom
+    // past what a double centre resolves; pixel size defaults to the full set.
+    DeepViewport view(DoubleDouble::parse(argc > 5 ? argv[5] : "-0.5"), DoubleDouble::parse(argc > 6 ? argv[6] : "0"),
+        argc > 7 ? atof(argv[7]) : (CxMax - CxMin) / iXmax, iXmax, iYmax);
+    if (formula == "julia")
+        runFormula(Julia(), view, tier, mode, frames, csv);
+    else if (formula == "burningship")
+        runFormula(BurningShip(), view, tier, mode, frames, csv);
+    else if (formula == "tricorn")
+        runFormula(Tricorn(), view, tier, mode, frames, csv);
+    else if (formula == "multibrot3")
+        runFormula(Multibrot<3>(), view, tier, mode, frames, csv);
+    else if (formula == "multibrot4")
+        runFormula(Multibrot<4>(), view, tier, mode, frames, csv);
+    else
+        runFormula(Mandelbrot(), view, tier, mode, frames, csv);
 
     csv.close();
     return 0;
 }
 
-void mandelbrotThreadGuided(int blockSize)
+void colorRow(int iY, const int* iterations, const unsigned char* threadColor, int x0 = 0, int x1 = iXmax)
 {
-    double Cx, Cy;
-    double PixelWidth = (CxMax - CxMin) / iXmax;
-    double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
-    double ER2 = EscapeRadius * EscapeRadius;
+    for (int iX = x0; iX < x1; iX++) {
+        if (iterations[iX - x0] == IterationMax) {
+            color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
+        } else {
+            color[iY][iX][0] = threadColor[0];
+            color[iY][iX][1] = threadColor[1];
+            color[iY][iX][2] = threadColor[2];
+        }
+    }
+}
 
-#pragma omp parallel private(Cx, Cy, Zx, Zy, Zx2, Zy2)
+template <class Engine>
+void mandelbrotThreadGuided(const Engine& engine, int blockSize)
+{
+#pragma omp parallel
     {
         auto start = omp_get_wtime();
         int tid = omp_get_thread_num();
 
-        long int localSum = 0;
+        MetricsSlot local;
+        std::vector<int> iterations(iXmax);
 
         unsigned char threadColor[3];
         threadColor[0] = (255 / nr_threads) * tid;
@@ -119,162 +293,193 @@ void mandelbrotThreadGuided(int blockSize)
 
 #pragma omp for schedule(guided, blockSize) nowait
         for (int iY = 0; iY < iYmax; ++iY) {
+            local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+            local.add(Pixels, iXmax);
+            local.add(Chunks);
+            colorRow(iY, iterations.data(), threadColor);
+        }
 
-            Cy = CyMin + iY * PixelHeight;
-            if (fabs(Cy) < PixelHeight / 2)
-                Cy = 0.0;
-
-            for (int iX = 0; iX < iXmax; iX++) {
-
-                Cx = CxMin + iX * PixelWidth;
+        // The loop is nowait, so the barrier time is this thread's share
+        // of the load imbalance.
+        double done = omp_get_wtime();
+        local.addTime(ExecTime, done - start);
+#pragma omp barrier
+        local.addTime(WaitTime, omp_get_wtime() - done);
+        metrics.merge(tid, local);
+    }
+}
 
-                Zx = Zy = 0.0;
-                Zx2 = Zy2 = 0.0;
+template <class Engine>
+void mandelbrotThreadStatic(const Engine& engine, int blockSize)
+{
+#pragma omp parallel
+    {
+        auto start = omp_get_wtime();
+        int tid = omp_get_thread_num();
 
-                int Iteration;
-                for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                    Iteration++) {
-                    Zy = 2 * Zx * Zy + Cy;
-                    Zx = Zx2 - Zy2 + Cx;
-                    Zx2 = Zx * Zx;
-                    Zy2 = Zy * Zy;
-                }
+        MetricsSlot local;
+        std::vector<int> iterations(iXmax);
 
-                localSum += Iteration;
+        unsigned char threadColor[3];
+        threadColor[0] = (255 / nr_threads) * tid;
+        threadColor[1] = 255 - threadColor[0];
+        threadColor[2] = 0;
 
-                if (Iteration == IterationMax) {
-                    color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-                } else {
-                    color[iY][iX][0] = threadColor[0];
-                    color[iY][iX][1] = threadColor[1];
-                    color[iY][iX][2] = threadColor[2];
-                }
-            }
+#pragma omp for schedule(static, blockSize) nowait
+        for (int iY = 0; iY < iYmax; ++iY) {
+            local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+            local.add(Pixels, iXmax);
+            local.add(Chunks);
+            colorRow(iY, iterations.data(), threadColor);
         }
 
-        sum[tid] = localSum;
-        auto end = omp_get_wtime();
-        threadExecTime[tid] = end - start;
+        double done = omp_get_wtime();
+        local.addTime(ExecTime, done - start);
+#pragma omp barrier
+        local.addTime(WaitTime, omp_get_wtime() - done);
+        metrics.merge(tid, local);
     }
 }
 
-void mandelbrotThreadStatic(int blockSize)
+template <class Engine>
+void mandelbrotThreadDynamic(const Engine& engine, int blockSize)
 {
-    double Cx, Cy;
-    double PixelWidth = (CxMax - CxMin) / iXmax;
-    double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
-    double ER2 = EscapeRadius * EscapeRadius;
-
-#pragma omp parallel private(Cx, Cy, Zx, Zy, Zx2, Zy2)
+#pragma omp parallel
     {
         auto start = omp_get_wtime();
         int tid = omp_get_thread_num();
 
-        long int localSum = 0;
+        MetricsSlot local;
+        std::vector<int> iterations(iXmax);
 
         unsigned char threadColor[3];
         threadColor[0] = (255 / nr_threads) * tid;
         threadColor[1] = 255 - threadColor[0];
         threadColor[2] = 0;
 
-#pragma omp for schedule(static, blockSize) nowait
+#pragma omp for schedule(dynamic, blockSize) nowait
         for (int iY = 0; iY < iYmax; ++iY) {
+            local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+            local.add(Pixels, iXmax);
+            local.add(Chunks);
+            colorRow(iY, iterations.data(), threadColor);
+        }
 
-            Cy = CyMin + iY * PixelHeight;
-            if (fabs(Cy) < PixelHeight / 2)
-                Cy = 0.0;
-
-            for (int iX = 0; iX < iXmax; iX++) {
-
-                Cx = CxMin + iX * PixelWidth;
+        double done = omp_get_wtime();
+        local.addTime(ExecTime, done - start);
+#pragma omp barrier
+        local.addTime(WaitTime, omp_get_wtime() - done);
+        metrics.merge(tid, local);
+    }
+}
 
-                Zx = Zy = 0.0;
-                Zx2 = Zy2 = 0.0;
+template <class Engine>
+void mandelbrotThreadRuntime(const Engine& engine)
+{
+#pragma omp parallel
+    {
+        auto start = omp_get_wtime();
+        int tid = omp_get_thread_num();
 
-                int Iteration;
-                for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                    Iteration++) {
-                    Zy = 2 * Zx * Zy + Cy;
-                    Zx = Zx2 - Zy2 + Cx;
-                    Zx2 = Zx * Zx;
-                    Zy2 = Zy * Zy;
-                }
+        MetricsSlot local;
+        std::vector<int> iterations(iXmax);
 
-                localSum += Iteration;
+        unsigned char threadColor[3];
+        threadColor[0] = (255 / nr_threads) * tid;
+        threadColor[1] = 255 - threadColor[0];
+        threadColor[2] = 0;
 
-                if (Iteration == IterationMax) {
-                    color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-                } else {
-                    color[iY][iX][0] = threadColor[0];
-                    color[iY][iX][1] = threadColor[1];
-                    color[iY][iX][2] = threadColor[2];
-                }
-            }
+#pragma omp for schedule(runtime) nowait
+        for (int iY = 0; iY < iYmax; ++iY) {
+            local.add(Iterations, engine.renderRow(iY, 0, iXmax, iterations.data()));
+            local.add(Pixels, iXmax);
+            local.add(Chunks);
+            colorRow(iY, iterations.data(), threadColor);
         }
 
-        sum[tid] = localSum;
-        auto end = omp_get_wtime();
-        threadExecTime[tid] = end - start;
+        double done = omp_get_wtime();
+        local.addTime(ExecTime, done - start);
+#pragma omp barrier
+        local.addTime(WaitTime, omp_get_wtime() - done);
+        metrics.merge(tid, local);
     }
 }
 
-void mandelbrotThreadDynamic(int blockSize)
+template <class Engine>
+void renderTile(const Engine& engine, TileShape tile, int tx, int ty, int* iterations,
+    const unsigned char* threadColor, MetricsSlot& local)
 {
-    double Cx, Cy;
-    double PixelWidth = (CxMax - CxMin) / iXmax;
-    double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
-    double ER2 = EscapeRadius * EscapeRadius;
+    int x0 = tx * tile.width, x1 = std::min(x0 + tile.width, iXmax);
+    int y0 = ty * tile.height, y1 = std::min(y0 + tile.height, iYmax);
+    for (int iY = y0; iY < y1; ++iY) {
+        local.add(Iterations, engine.renderRow(iY, x0, x1, iterations));
+        colorRow(iY, iterations, threadColor, x0, x1);
+    }
+    local.add(Pixels, long(x1 - x0) * (y1 - y0));
+    local.add(Chunks);
+}
+
+// Both tile loops are collapsed into one iteration space, so the chunk of
+// OMP_SCHEDULE counts tiles and neighbouring chunks cover both directions.
+template <class Engine>
+void mandelbrotTilesCollapse(const Engine& engine, TileShape tile)
+{
+    int tilesX = (iXmax + tile.width - 1) / tile.width;
+    int tilesY = (iYmax + tile.height - 1) / tile.height;
 
-#pragma omp parallel private(Cx, Cy, Zx, Zy, Zx2, Zy2)
+#pragma omp parallel
     {
         auto start = omp_get_wtime();
         int tid = omp_get_thread_num();
-        long int localSum = 0;
+
+        MetricsSlot local;
+        std::vector<int> iterations(tile.width);
 
         unsigned char threadColor[3];
         threadColor[0] = (255 / nr_threads) * tid;
         threadColor[1] = 255 - threadColor[0];
         threadColor[2] = 0;
 
-#pragma omp for schedule(dynamic, blockSize) nowait
-        for (int iY = 0; iY < iYmax; ++iY) {
-
-            Cy = CyMin + iY * PixelHeight;
-            if (fabs(Cy) < PixelHeight / 2)
-                Cy = 0.0;
-
-            for (int iX = 0; iX < iXmax; iX++) {
-
-                Cx = CxMin + iX * PixelWidth;
+#pragma omp for collapse(2) schedule(runtime) nowait
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx)
+                renderTile(engine, tile, tx, ty, iterations.data(), threadColor, local);
+        }
 
-                Zx = Zy = 0.0;
-                Zx2 = Zy2 = 0.0;
+        double done = omp_get_wtime();
+        local.addTime(ExecTime, done - start);
+#pragma omp barrier
+        local.addTime(WaitTime, omp_get_wtime() - done);
+        metrics.merge(tid, local);
+    }
+}
 
-                int Iteration;
-                for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                    Iteration++) {
-                    Zy = 2 * Zx * Zy + Cy;
-                    Zx = Zx2 - Zy2 + Cx;
-                    Zx2 = Zx * Zx;
-                    Zy2 = Zy * Zy;
-                }
+// One thread creates tasks of grainsize tiles each and the whole team
+// executes them. A task records into the slot of whichever thread runs it.
+template <class Engine>
+void mandelbrotTaskloop(const Engine& engine, TileShape tile, int grainsize)
+{
+    int tilesX = (iXmax + tile.width - 1) / tile.width;
+    int tilesY = (iYmax + tile.height - 1) / tile.height;
+    std::vector<std::vector<int>> iterations(nr_threads, std::vector<int>(tile.width));
 
-                localSum += Iteration;
+#pragma omp parallel
+    {
+        auto start = omp_get_wtime();
 
-                if (Iteration == IterationMax) {
-                    color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-                } else {
-                    color[iY][iX][0] = threadColor[0];
-                    color[iY][iX][1] = threadColor[1];
-                    color[iY][iX][2] = threadColor[2];
-                }
+#pragma omp single
+#pragma omp taskloop collapse(2) grainsize(grainsize)
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                int tid = omp_get_thread_num();
+                unsigned char threadColor[3];
+                threadColor[0] = (255 / nr_threads) * tid;
+                threadColor[1] = 255 - threadColor[0];
+                threadColor[2] = 0;
+                renderTile(engine, tile, tx, ty, iterations[tid].data(), threadColor, metrics[tid]);
             }
         }
 
-        sum[tid] = localSum;
-        auto end = omp_get_wtime();
-        threadExecTime[tid] = end - start;
+        metrics.addTime(omp_get_thread_num(), ExecTime, omp_get_wtime() - start);
     }
 }
@@ -1,41 +1,141 @@
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <omp.h>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../../common/autotune.hpp"
+#include "../../common/huge_buffer.hpp"
+#include "../../common/metrics.hpp"
+#include "../../common/miller_rabin.hpp"
+#include "../../common/placement.hpp"
+#include "../../common/png_writer.hpp"
+#include "../../common/prime_sieve.hpp"
+
+ThreadMetrics metrics;
+Placement placement = Placement::fromEnv();
+
+// OS threads a parallel construct keeps in its teams: the product of the
+// team sizes of all enclosing levels. Nested regions hold many more
+// threads than there are cores; the peak divided by the cores is the
+// oversubscription.
+class ThreadCensus {
+public:
+    void reset() { peak = 0; }
+
+    // Called by the threads of the innermost region.
+    void record()
+    {
+        int threads = 1;
+        for (int level = 1; level <= omp_get_level(); ++level)
+            threads *= omp_get_team_size(level);
+        int seen = peak.load(std::memory_order_relaxed);
+        while (threads > seen && !peak.compare_exchange_weak(seen, threads)) { }
+    }
 
-double threadExecTime[128];
+    int peakThreads() const { return peak; }
+    double oversubscription() const { return double(peak) / omp_get_num_procs(); }
 
-bool isPrime(int);
+private:
+    std::atomic<int> peak { 0 };
+};
+
+ThreadCensus census;
+
+bool isPrime(long);
+long spiralNumber(long cx, long cy);
+void spiralCoordinates(long n, long& cx, long& cy);
+size_t residentBytes();
+bool pwriteAll(int fd, const void* data, size_t bytes, off_t offset);
+
+// Trial division tests every cell on its own; the sieve marks all numbers
+// up to the largest one in the window once and every cell is then a bit
+// lookup; Miller-Rabin tests every cell in O(log n). Auto picks the sieve
+// or Miller-Rabin per window, whichever is expected to be cheaper.
+enum class PrimeTest {
+    TrialDivision,
+    Sieve,
+    MillerRabin,
+    Auto
+};
+
+// Auto sieves only up to SieveAutoLimit (256 MiB of bits), and only while
+// the sieve covers fewer than SieveNumbersPerTest numbers per cell: one
+// Miller-Rabin test near 10^15 costs about as much as sieving 64 numbers.
+const uint64_t SieveAutoLimit = uint64_t(1) << 32;
+const int SieveNumbersPerTest = 64;
 
 class UlamSpiral {
 public:
-    UlamSpiral(int size = 4, int threads = 1);
+    UlamSpiral(int size = 4, int threads = 1, bool lazy = false);
     ~UlamSpiral();
 
     void changeThreadsToUse(int threads);
     void changeSize(int newSize);
+    void setRingGrowth(bool grow) { ringGrowth = grow; }
     void mapPrimes(int blockSize);
     void mapPrimesNest(int blockSize);
+    void mapPrimesTasks(int blockSize, int grain);
+    void mapPrimesTiled(int tileRows, int tileCols, const std::string& schedule);
+
+    void setPrimeTest(PrimeTest test);
+    void sievePrimes();
+    void setLazyMapping(bool lazy);
+    void setOrigin(long cx, long cy);
+    void centerOn(long n);
 
     void printMatrix();
     void saveToPPM(std::string fileName, int scale = 1);
+    void saveToPNG(std::string fileName, int scale = 1);
+    bool savePPMParallel(const std::string& fileName, int scale = 1);
+    bool savePBM(const std::string& fileName, int scale = 1);
 
     int getSize() { return Size; }
     int getNumOfThreads() { return threadsToUse; }
+    PrimeTest getPrimeTest() { return primeTest; }
+    PrimeTest getActivePrimeTest() { return activeTest; }
+    long windowMaxNumber();
+    bool getLazyMapping() { return lazyMapping; }
+    bool getRingGrowth() { return ringGrowth; }
+    double getSieveTime() { return sieveTime; }
 
 private:
-    int** Matrix;
-
-    unsigned char*** ColorMatrix;
+    // Row-major Size x Size grids: the spiral numbers and packed RGB.
+    HugeBuffer<long> Matrix;
+    HugeBuffer<unsigned char> ColorMatrix;
     unsigned char** ColorThreads;
 
     int Size;
     int threadsToUse;
+    // Spiral coordinates of the window's centre cell; (0, 0) is where 1 is.
+    long originX = 0;
+    long originY = 0;
+
+    // Lazy mapping never builds Matrix; the numbers are computed while
+    // the cells are classified.
+    bool lazyMapping;
+    // With ring growth a larger size keeps the classified centre and
+    // classifies only the new rings around it.
+    bool ringGrowth = false;
+    PrimeTest primeTest = PrimeTest::TrialDivision;
+    PrimeTest activeTest = PrimeTest::TrialDivision;
+    PrimeSieve sieve;
+    double sieveTime = 0;
 
     void applyMapping();
     void applyColorThreads();
+    void growRings(int newSize);
 
     void allocMatrix();
     void allocColorMatrix();
@@ -45,7 +145,115 @@ private:
     void deleteColorMatrix();
     void deleteColorThreads();
 
-    int getMapping(int x, int y);
+    long getMapping(int x, int y);
+    long& number(int x, int y) { return Matrix[size_t(x) * Size + y]; }
+    long centredX(int x) const { return x - (Size - 1) / 2 + originX; }
+    long centredY(int y) const { return y - Size / 2 + originY; }
+    unsigned char* color(int x, int y) { return &ColorMatrix[(size_t(x) * Size + y) * 3]; }
+
+    template <typename Body>
+    void walkRow(int x, int y0, int y1, Body body) const;
+    void classifyRow(int x, int y0, int y1, const unsigned char* threadColor);
+    void resolvePrimeTest();
+
+    bool cellIsPrime(long n) const
+    {
+        switch (activeTest) {
+        case PrimeTest::Sieve:
+            return sieve.isPrime(n);
+        case PrimeTest::MillerRabin:
+            return millerRabin(n);
+        default:
+            return isPrime(n);
+        }
+    }
+};
+
+// Any rectangle of the unbounded spiral: image row r, column c is the cell
+// (x0 + r, y0 + c), as in UlamSpiral::saveToPNG. The image is rendered one
+// band of tileSize rows at a time and each band is streamed to the PNG
+// writer, so memory is bounded by the band and the tiles in flight, not by
+// the distance from 1. A tile sieves only the runs of numbers its rings
+// pass through; tiles beyond SieveAutoLimit use Miller-Rabin instead.
+class SpiralWindow {
+public:
+    SpiralWindow(long x0, long y0, int width, int height, int tileSize = 256);
+
+    bool render(const std::string& fileName, int threads);
+
+    long getSievedTiles() { return sievedTiles; }
+    long getTestedTiles() { return testedTiles; }
+    long getSievedNumbers() { return sievedNumbers; }
+    size_t getBandBytes() { return size_t(TileSize) * Width * 3; }
+    size_t getPeakTileBytes() { return peakTileBytes; }
+
+private:
+    // Consecutive numbers [first, last] whose bits start at word.
+    struct Run {
+        uint64_t first;
+        uint64_t last;
+        uint64_t low;
+        size_t word;
+    };
+
+    long X0;
+    long Y0;
+    int Width;
+    int Height;
+    int TileSize;
+
+    std::vector<unsigned char> band;
+    std::vector<uint32_t> primes;
+    std::vector<uint64_t> reciprocals; // 2^64 / p rounded up, for markRun
+    long sievedTiles = 0;
+    long testedTiles = 0;
+    long sievedNumbers = 0;
+    size_t peakTileBytes = 0;
+
+    void renderBand(int r0, int threads);
+    void renderTile(int r0, int c0, int rows, int cols, const unsigned char* rgb, std::vector<Run>& runs,
+        std::vector<uint64_t>& bits);
+    static void collectRuns(long cx0, long cx1, long cy0, long cy1, std::vector<Run>& runs);
+    void markRun(uint64_t* words, size_t count, uint32_t low) const;
+};
+
+// One line of the spiral and the primes on it. Index is the offset cx - cy
+// of a diagonal, cx + cy of an anti-diagonal or the ring; quadratics
+// 4n^2 + bn + c are keyed by b and c.
+struct DensityLine {
+    const char* kind;
+    long index;
+    int b;
+    int c;
+    long cells;
+    long primes;
+
+    double density() const { return cells ? double(primes) / cells : 0; }
+};
+
+// Prime counts along the lines of a Size x Size spiral centred on 1, read
+// from the sieve bitmap. Rings are scanned in parallel, skipping composites
+// a word at a time; every thread counts into private copies of the
+// diagonal, anti-diagonal and ring arrays, which OpenMP sums at the end.
+class PrimeDensity {
+public:
+    explicit PrimeDensity(int size);
+
+    void countLines();
+    void countQuadratics(int bRange, int cRange);
+
+    void writeCSV(const std::string& fileName);
+    void printTop(std::ostream& out, int k, long minCells);
+
+private:
+    int Size;
+    long xLo, xHi, yLo, yHi; // the window in spiral coordinates
+    long rings;
+    PrimeSieve sieve;
+    std::vector<DensityLine> lines;
+
+    bool inside(long cx, long cy) const { return cx >= xLo && cx <= xHi && cy >= yLo && cy <= yHi; }
+    long boxCells(long k) const;
 };
 
 ///////////////////////////////////////////
@@ -59,15 +267,15 @@ double runExperiment(const std::string& name, Func func, UlamSpiral& spiral, int
 
     for (int t = 1; t <= 16; t *= 2) {
         spiral.changeThreadsToUse(t);
+        if (spiral.getActivePrimeTest() == PrimeTest::Sieve)
+            spiral.sievePrimes();
         for (int block = maxBlockSize / 16; block <= maxBlockSize / 2; block *= blockJump) {
 
-            for (int i = 0; i < spiral.getNumOfThreads(); i++) {
-                threadExecTime[i] = 0.0;
-            }
-
             avgTime = 0;
+            census.reset();
 
             for (int r = 0; r < runs; ++r) {
+                metrics.reset();
 
                 double start = omp_get_wtime();
                 func(block);
@@ -80,33 +288,451 @@ double runExperiment(const std::string& name, Func func, UlamSpiral& spiral, int
 
             std::cout << name << std::endl
                       << "BlockSize = " << block
-                      << ", avg time = " << avgTime << " s\n";
+                      << ", avg time = " << avgTime << " s"
+                      << ", peak threads = " << census.peakThreads() << " on " << omp_get_num_procs()
+                      << " cores (x" << census.oversubscription() << ")\n";
 
-            for (int tid = 0; tid < spiral.getNumOfThreads(); ++tid) {
-                std::cout << "Thread " << tid
-                          << ", time = " << threadExecTime[tid]
-                          << " s\n";
-            }
+            metrics.print(std::cout);
 
             std::cout << "\n";
 
+            double sieveTime = spiral.getActivePrimeTest() == PrimeTest::Sieve ? spiral.getSieveTime() : 0;
             csv << name << "," << spiral.getNumOfThreads() << "," << spiral.getSize() << ","
-                << block << "," << avgTime << "\n";
+                << block << "," << avgTime << "," << placement.name() << "," << sieveTime << ","
+                << census.peakThreads() << "\n";
         }
     }
 
     return 0;
 }
 
-int main()
+// mapPrimes always schedules its blocks dynamically, so the tuner only
+// searches block size (as the chunk) and thread count. Size / 2 is left
+// out: its four blocks cannot keep more than four threads busy. Runs until
+// a candidate is locked in, then tunedFrames more with it.
+void runTuned(UlamSpiral& spiral, int tunedFrames)
+{
+    std::vector<TuneConfig> candidates;
+    for (int block = spiral.getSize() / 16; block <= spiral.getSize() / 4; block *= 2)
+        for (int threads = 1; threads <= 16; threads *= 2)
+            candidates.push_back({ "dynamic", block, threads });
+
+    AutoTuner tuner("LAB05-UlamBlocks", spiral.getSize(), candidates, "../autotune.db");
+    if (tuner.fromDatabase())
+        std::cout << "Tuned from database: " << tuner.current().name() << std::endl;
+
+    int frames = tuner.framesToLock() + tunedFrames;
+    for (int frame = 0; frame < frames; ++frame) {
+        TuneConfig config = tuner.current();
+        bool tuned = tuner.locked();
+        if (config.threads != spiral.getNumOfThreads())
+            spiral.changeThreadsToUse(config.threads);
+
+        double start = omp_get_wtime();
+        spiral.mapPrimes(config.chunk);
+        double seconds = omp_get_wtime() - start;
+        tuner.report(seconds);
+
+        std::cout << "Frame " << frame << (tuned ? ", tuned " : ", exploring ") << config.name() << ": " << seconds
+                  << " s\n";
+    }
+    std::cout << "Best: " << tuner.best().name() << std::endl;
+}
+
+// Sieve against trial division without the spiral matrix: every number up
+// to Size^2 is classified once. Trial division stops at
+// trialDivisionMaxSize, beyond that it takes minutes.
+void runSieveSweep(int maxSize)
+{
+    const int trialDivisionMaxSize = 4096;
+    int threads = omp_get_max_threads();
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+
+    bool newFile = !std::filesystem::exists("results.csv");
+    std::ofstream csv("results.csv", std::ios::app);
+    if (newFile)
+        csv << "Name,Threads,Size,BlockSize,AvgTime,Placement,SieveTime,PeakThreads\n";
+
+    for (int size = 1024; size <= maxSize; size *= 2) {
+        long count = long(size) * size;
+        PrimeSieve sieve;
+        double start = omp_get_wtime();
+        sieve.sieve(count);
+        double sieveTime = omp_get_wtime() - start;
+
+        long primes = 0;
+        start = omp_get_wtime();
+#pragma omp parallel for reduction(+ : primes)
+        for (long n = 1; n <= count; ++n)
+            primes += sieve.isPrime(n);
+        double lookupTime = omp_get_wtime() - start;
+
+        std::cout << "Size " << size << ": " << primes << " primes, sieve " << sieveTime << " s ("
+                  << sieve.bytes() / double(1 << 20) << " MiB), lookup " << lookupTime << " s";
+        csv << "SieveLookup," << threads << "," << size << ",0," << lookupTime << "," << placement.name() << ","
+            << sieveTime << "," << threads << "\n";
+
+        if (size <= trialDivisionMaxSize) {
+            long trialPrimes = 0;
+            start = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic, 4096) reduction(+ : trialPrimes)
+            for (long n = 1; n <= count; ++n)
+                trialPrimes += isPrime(n);
+            double trialTime = omp_get_wtime() - start;
+            std::cout << ", trial division " << trialTime << " s" << (trialPrimes == primes ? "" : " (MISMATCH)");
+            csv << "TrialDivision," << threads << "," << size << ",0," << trialTime << "," << placement.name()
+                << ",0," << threads << "\n";
+        }
+        std::cout << std::endl;
+    }
+}
+
+const char* primeTestName(PrimeTest test)
+{
+    switch (test) {
+    case PrimeTest::Sieve:
+        return "sieve";
+    case PrimeTest::MillerRabin:
+        return "Miller-Rabin";
+    case PrimeTest::Auto:
+        return "auto";
+    default:
+        return "trial division";
+    }
+}
+
+// A size x size window of the spiral centred on number center, with the
+// prime test picked for the window. The window at the origin is run too,
+// for comparison.
+void runWindow(long center, int size)
+{
+    int threads = omp_get_max_threads();
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+    UlamSpiral spiral(size, threads, true);
+    spiral.setPrimeTest(PrimeTest::Auto);
+
+    for (long n : { 1L, center }) {
+        spiral.centerOn(n);
+        double start = omp_get_wtime();
+        spiral.mapPrimes(std::max(1, size / 16));
+        double seconds = omp_get_wtime() - start;
+        std::cout << "Window " << size << "x" << size << " around " << n << " (up to "
+                  << spiral.windowMaxNumber() << "): " << primeTestName(spiral.getActivePrimeTest()) << ", "
+                  << seconds << " s" << std::endl;
+    }
+    spiral.saveToPNG("../PPMs/window.png", 1);
+}
+
+// The rectangle at spiral coordinates (x0, y0) of height rows and width
+// columns, streamed to ../PPMs/region.png.
+void runRegion(long x0, long y0, int width, int height, int tileSize)
+{
+    int threads = omp_get_max_threads();
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+    SpiralWindow window(x0, y0, width, height, tileSize);
+
+    double start = omp_get_wtime();
+    if (!window.render("../PPMs/region.png", threads)) {
+        std::cerr << "cannot write ../PPMs/region.png" << std::endl;
+        return;
+    }
+    double seconds = omp_get_wtime() - start;
+    std::cout << "Region " << width << "x" << height << " at (" << x0 << ", " << y0 << "), tiles " << tileSize
+              << ": " << seconds << " s, " << window.getSievedTiles() << " tiles sieved ("
+              << window.getSievedNumbers() << " numbers), " << window.getTestedTiles()
+              << " tiles by Miller-Rabin, band " << window.getBandBytes() / double(1 << 20) << " MiB, tile sieve "
+              << window.getPeakTileBytes() / double(1 << 10) << " KiB" << std::endl;
+}
+
+// Fastest earlier time in results.csv for a full trial-division map of a
+// size x size spiral, or 0 if there is none.
+double previousBest(int size)
+{
+    std::ifstream in("results.csv");
+    std::string line;
+    std::getline(in, line);
+    double best = 0;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name, threads, rowSize, block, time;
+        if (!std::getline(fields, name, ',') || !std::getline(fields, threads, ',')
+            || !std::getline(fields, rowSize, ',') || !std::getline(fields, block, ',')
+            || !std::getline(fields, time, ','))
+            continue;
+        bool fullMap = name.rfind("UlamBlocks", 0) == 0 || name.rfind("UlamTasks", 0) == 0
+            || name.rfind("UlamBest", 0) == 0;
+        if (!fullMap || atoi(rowSize.c_str()) != size)
+            continue;
+        double seconds = atof(time.c_str());
+        if (seconds > 0 && (best == 0 || seconds < best))
+            best = seconds;
+    }
+    return best;
+}
+
+// Every schedule, tile shape and thread count on a size x size spiral with
+// trial division, whose cost grows towards the edge. Each configuration
+// runs runs times after a warm-up; mean, standard deviation and minimum go
+// to schedules.csv. The fastest mean is appended to results.csv as
+// UlamBest-<schedule>-<rows>x<cols> after it is checked against the
+// fastest earlier run of the same size: slower by more than 5% or two
+// standard deviations counts as a regression.
+bool runScheduleSweep(int size, int runs)
+{
+    struct Shape {
+        int rows, cols;
+    };
+    const Shape shapes[] = {
+        { std::max(1, size / 16), std::max(1, size / 16) },
+        { std::max(1, size / 8), std::max(1, size / 8) },
+        { 8, size },
+        { std::max(1, size / 64), std::max(1, size / 4) },
+    };
+    const char* schedules[] = { "static", "dynamic", "guided", "taskloop" };
+
+    struct Result {
+        std::string schedule;
+        Shape shape;
+        int threads;
+        double mean, deviation;
+    };
+    Result best { "", { 0, 0 }, 0, 0, 0 };
+
+    bool newFile = !std::filesystem::exists("schedules.csv");
+    std::ofstream csv("schedules.csv", std::ios::app);
+    if (newFile)
+        csv << "Size,Threads,Schedule,TileRows,TileCols,Runs,MeanTime,StdDev,MinTime,Placement\n";
+
+    UlamSpiral spiral(size);
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        spiral.changeThreadsToUse(threads);
+        for (const char* schedule : schedules) {
+            for (const Shape& shape : shapes) {
+                spiral.mapPrimesTiled(shape.rows, shape.cols, schedule);
+                std::vector<double> times;
+                for (int r = 0; r < runs; ++r) {
+                    double start = omp_get_wtime();
+                    spiral.mapPrimesTiled(shape.rows, shape.cols, schedule);
+                    times.push_back(omp_get_wtime() - start);
+                }
+
+                double mean = 0, variance = 0;
+                for (double t : times)
+                    mean += t / runs;
+                for (double t : times)
+                    variance += (t - mean) * (t - mean) / std::max(1, runs - 1);
+                double deviation = std::sqrt(variance);
+                double fastest = *std::min_element(times.begin(), times.end());
+
+                std::cout << schedule << ", " << shape.rows << "x" << shape.cols << ", threads: " << threads
+                          << ", mean " << mean << " s +- " << deviation << ", min " << fastest << std::endl;
+                csv << size << "," << threads << "," << schedule << "," << shape.rows << "," << shape.cols << ","
+                    << runs << "," << mean << "," << deviation << "," << fastest << "," << placement.name() << "\n";
+
+                if (best.threads == 0 || mean < best.mean)
+                    best = { schedule, shape, threads, mean, deviation };
+            }
+        }
+    }
+    csv.close();
+
+    std::string name = "UlamBest-" + best.schedule + "-" + std::to_string(best.shape.rows) + "x"
+        + std::to_string(best.shape.cols);
+    std::cout << "Best for size " << size << ": " << name << ", " << best.threads << " threads, " << best.mean
+              << " s +- " << best.deviation << std::endl;
+
+    bool regression = false;
+    double previous = previousBest(size);
+    if (previous > 0) {
+        double tolerance = std::max(0.05 * previous, 2 * best.deviation);
+        regression = best.mean > previous + tolerance;
+        std::cout << (regression ? "REGRESSION" : "No regression") << ": previous best " << previous << " s"
+                  << std::endl;
+    }
+
+    bool newResults = !std::filesystem::exists("results.csv");
+    std::ofstream results("results.csv", std::ios::app);
+    if (newResults)
+        results << "Name,Threads,Size,BlockSize,AvgTime,Placement,SieveTime,PeakThreads\n";
+    results << name << "," << best.threads << "," << size << "," << best.shape.rows << "," << best.mean << ","
+            << placement.name() << ",0," << best.threads << "\n";
+    return !regression;
+}
+
+// An interactive sweep growing the spiral by step from 1024 to maxSize,
+// once rebuilding and reclassifying everything at every size and once
+// growing ring by ring. The total times go to results.csv with the step
+// as BlockSize.
+void runGrowth(int maxSize, int step)
+{
+    int threads = omp_get_max_threads();
+    bool newFile = !std::filesystem::exists("results.csv");
+    std::ofstream csv("results.csv", std::ios::app);
+    if (newFile)
+        csv << "Name,Threads,Size,BlockSize,AvgTime,Placement,SieveTime,PeakThreads\n";
+
+    for (bool grow : { false, true }) {
+        UlamSpiral spiral(1024, threads, true);
+        spiral.setPrimeTest(PrimeTest::Sieve);
+        spiral.setRingGrowth(grow);
+        spiral.mapPrimes(64);
+
+        double start = omp_get_wtime();
+        for (int size = 1024 + step; size <= maxSize; size += step) {
+            spiral.changeSize(size);
+            if (!grow)
+                spiral.mapPrimes(64);
+        }
+        double seconds = omp_get_wtime() - start;
+
+        const char* name = grow ? "GrowRings" : "GrowRebuild";
+        std::cout << name << ", 1024 to " << spiral.getSize() << " by " << step << ": " << seconds << " s"
+                  << std::endl;
+        csv << name << "," << threads << "," << spiral.getSize() << "," << step << "," << seconds << ","
+            << placement.name() << ",0," << threads << "\n";
+    }
+}
+
+// Prime densities of a size x size spiral: lines, then quadratics with
+// |b| <= bRange and |c| <= cRange, to density.csv and the topK of each kind
+// to the console.
+void runDensity(int size, int bRange, int cRange, int topK)
+{
+    double start = omp_get_wtime();
+    PrimeDensity density(size);
+    double lines = omp_get_wtime();
+    density.countLines();
+    double quadratics = omp_get_wtime();
+    density.countQuadratics(bRange, cRange);
+    double end = omp_get_wtime();
+
+    std::cout << "Size " << size << ": sieve " << lines - start << " s, lines " << quadratics - lines
+              << " s, quadratics " << end - quadratics << " s" << std::endl;
+    density.writeCSV("density.csv");
+    density.printTop(std::cout, topK, size / 4);
+}
+
+// Write throughput of the exporters for a size x size spiral at the given
+// scale, in MB of file and in megapixels per second. Old files are removed
+// first so their truncation is not timed; the PPMs are removed afterwards.
+void runExport(int size, int scale)
+{
+    int threads = omp_get_max_threads();
+    UlamSpiral spiral(size, threads, true);
+    spiral.setPrimeTest(PrimeTest::Sieve);
+    spiral.mapPrimes(std::max(1, size / 16));
+
+    struct Exporter {
+        const char* name;
+        std::string fileName;
+        std::function<bool(const std::string&)> save;
+    };
+    const Exporter exporters[] = {
+        { "PPM ofstream", "../PPMs/export.ppm",
+            [&](const std::string& fileName) {
+                spiral.saveToPPM(fileName, scale);
+                return true;
+            } },
+        { "PPM pwrite", "../PPMs/export_parallel.ppm",
+            [&](const std::string& fileName) { return spiral.savePPMParallel(fileName, scale); } },
+        { "PBM pwrite", "../PPMs/export.pbm",
+            [&](const std::string& fileName) { return spiral.savePBM(fileName, scale); } },
+    };
+
+    double megapixels = double(size) * scale * size * scale / 1e6;
+    for (const Exporter& e : exporters) {
+        std::filesystem::remove(e.fileName);
+        double start = omp_get_wtime();
+        bool ok = e.save(e.fileName);
+        double seconds = omp_get_wtime() - start;
+        if (!ok || !std::filesystem::exists(e.fileName)) {
+            std::cerr << "cannot write " << e.fileName << std::endl;
+            continue;
+        }
+        double mb = std::filesystem::file_size(e.fileName) / 1e6;
+        std::cout << e.name << ", threads: " << threads << ", " << mb << " MB, " << seconds << " s, "
+                  << mb / seconds << " MB/s, " << megapixels / seconds << " Mpixel/s" << std::endl;
+    }
+    std::filesystem::remove(exporters[0].fileName);
+    std::filesystem::remove(exporters[1].fileName);
+}
+
+// Construction and destruction time of the spiral and the memory it holds.
+void runMemoryReport(int maxSize)
+{
+    for (int size = 1024; size <= maxSize; size *= 2) {
+        for (bool lazy : { false, true }) {
+            size_t before = residentBytes();
+            double start = omp_get_wtime();
+            UlamSpiral* spiral = new UlamSpiral(size, 1, lazy);
+            double built = omp_get_wtime() - start;
+            size_t resident = residentBytes() - before;
+
+            start = omp_get_wtime();
+            delete spiral;
+            double destroyed = omp_get_wtime() - start;
+
+            std::cout << "Size " << size << (lazy ? ", lazy" : "") << ": construct " << built << " s, destroy "
+                      << destroyed << " s, RSS " << resident / double(1 << 20) << " MiB" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
 {
     int size = 1024;
 
+    if (argc > 1 && std::string(argv[1]) == "sieve") {
+        runSieveSweep(argc > 2 ? atoi(argv[2]) : 32768);
+        return 0;
+    }
+    if (argc > 2 && std::string(argv[1]) == "window") {
+        runWindow(atol(argv[2]), argc > 3 ? atoi(argv[3]) : 1024);
+        return 0;
+    }
+    if (argc > 5 && std::string(argv[1]) == "region") {
+        runRegion(atol(argv[2]), atol(argv[3]), atoi(argv[4]), atoi(argv[5]), argc > 6 ? atoi(argv[6]) : 256);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "grow") {
+        runGrowth(argc > 2 ? atoi(argv[2]) : 4096, argc > 3 ? atoi(argv[3]) : 64);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "density") {
+        runDensity(argc > 2 ? atoi(argv[2]) : 32768, argc > 3 ? atoi(argv[3]) : 40, argc > 4 ? atoi(argv[4]) : 40,
+            argc > 5 ? atoi(argv[5]) : 10);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "schedules") {
+        bool passed = true;
+        for (int i = 2; i < std::max(argc, 3); ++i)
+            passed &= runScheduleSweep(i < argc ? atoi(argv[i]) : size, 5);
+        return passed ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "export") {
+        runExport(argc > 2 ? atoi(argv[2]) : 4096, argc > 3 ? atoi(argv[3]) : 2);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "memory") {
+        runMemoryReport(argc > 2 ? atoi(argv[2]) : 8192);
+        return 0;
+    }
+
     omp_set_nested(1);
     UlamSpiral spiral(size);
 
-    std::ofstream csv("results.csv");
-    csv << "Name,Threads,Size,BlockSize,AvgTime\n";
+    if (argc > 1 && std::string(argv[1]) == "tune") {
+        runTuned(spiral, argc > 2 ? atoi(argv[2]) : 10);
+        return 0;
+    }
+
+    bool newFile = !std::filesystem::exists("results.csv");
+    std::ofstream csv("results.csv", std::ios::app);
+    if (newFile)
+        csv << "Name,Threads,Size,BlockSize,AvgTime,Placement,SieveTime,PeakThreads\n";
 
     runExperiment(
         "UlamBlocks",
@@ -115,31 +741,68 @@ int main()
         5,
         csv);
 
+    // Inner teams inherit the mask of the thread that forks them, so under a
+    // pinned outer team every inner team would share its parent's CPU. The
+    // nested variant runs on released threads and is recorded as unpinned.
+    Placement requested = placement;
+    placement = Placement();
     runExperiment(
         "UlamBlocksNest",
         [&](int blockSize) { spiral.mapPrimesNest(blockSize); },
         spiral,
         5,
         csv);
+    placement = requested;
+
+    for (int grain : { 1, 8, 64 }) {
+        runExperiment(
+            "UlamTasksGrain" + std::to_string(grain),
+            [&](int blockSize) { spiral.mapPrimesTasks(blockSize, grain); },
+            spiral,
+            5,
+            csv);
+    }
+
+    spiral.setPrimeTest(PrimeTest::Sieve);
+    runExperiment(
+        "UlamSieve",
+        [&](int blockSize) { spiral.mapPrimes(blockSize); },
+        spiral,
+        5,
+        csv);
+
+    spiral.setLazyMapping(true);
+    runExperiment(
+        "UlamSieveLazy",
+        [&](int blockSize) { spiral.mapPrimes(blockSize); },
+        spiral,
+        5,
+        csv);
     csv.close();
 
     spiral.changeThreadsToUse(4);
     spiral.mapPrimes(size / 2);
-    spiral.saveToPPM("../PPMs/2x2.ppm");
+    spiral.saveToPNG("../PPMs/2x2.png");
 }
 
 ///////////////////////////////////////////
 
-UlamSpiral::UlamSpiral(int size, int threads)
+UlamSpiral::UlamSpiral(int size, int threads, bool lazy)
     : Size(size)
     , threadsToUse(threads)
+    , lazyMapping(lazy)
 {
     allocColorMatrix();
-    allocMatrix();
     allocColorThreads();
     omp_set_num_threads(threadsToUse);
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+    metrics.reset(threadsToUse);
 
-    applyMapping();
+    if (!lazyMapping) {
+        allocMatrix();
+        applyMapping();
+    }
     applyColorThreads();
 }
 
@@ -156,19 +819,159 @@ void UlamSpiral::changeThreadsToUse(int threads)
     allocColorThreads();
     applyColorThreads();
     omp_set_num_threads(threads);
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+    metrics.reset(threads);
 }
 
 void UlamSpiral::changeSize(int newSize)
 {
+    if (ringGrowth && newSize > Size) {
+        growRings(newSize);
+        return;
+    }
+
     deleteColorMatrix();
     deleteMatrix();
 
     Size = newSize;
 
     allocColorMatrix();
-    allocMatrix();
+    if (!lazyMapping) {
+        allocMatrix();
+        applyMapping();
+    }
+    resolvePrimeTest();
+}
+
+// The old grid is the centre of the new one, shifted by (dx, dy). It is
+// copied over, the sieve is extended to the new outer ring, and only the
+// cells around the old grid are mapped and classified, split into row
+// segments of at most GrowSegment cells that are scheduled dynamically.
+void UlamSpiral::growRings(int newSize)
+{
+    const int GrowSegment = 1024;
+    int oldSize = Size;
+    int dx = (newSize - 1) / 2 - (oldSize - 1) / 2;
+    int dy = newSize / 2 - oldSize / 2;
+
+    HugeBuffer<unsigned char> oldColor = std::move(ColorMatrix);
+    HugeBuffer<long> oldMatrix = std::move(Matrix);
+    Size = newSize;
+    allocColorMatrix();
+    if (!lazyMapping)
+        allocMatrix();
+
+#pragma omp parallel for
+    for (int x = 0; x < oldSize; ++x) {
+        const unsigned char* from = &oldColor[size_t(x) * oldSize * 3];
+        std::copy(from, from + size_t(oldSize) * 3, color(x + dx, dy));
+        if (!lazyMapping)
+            std::copy(&oldMatrix[size_t(x) * oldSize], &oldMatrix[size_t(x) * oldSize] + oldSize, &number(x + dx, dy));
+    }
+    oldColor.reset();
+    oldMatrix.reset();
+    resolvePrimeTest();
+
+    struct Segment {
+        int x, y0, y1;
+    };
+    std::vector<Segment> segments;
+    auto addSpan = [&](int x, int y0, int y1) {
+        for (int y = y0; y < y1; y += GrowSegment)
+            segments.push_back({ x, y, std::min(y + GrowSegment, y1) });
+    };
+    for (int x = 0; x < Size; ++x) {
+        if (x < dx || x >= dx + oldSize) {
+            addSpan(x, 0, Size);
+        } else {
+            addSpan(x, 0, dy);
+            addSpan(x, dy + oldSize, Size);
+        }
+    }
 
-    applyMapping();
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        MetricsSlot local;
+        double start = omp_get_wtime();
+#pragma omp for schedule(dynamic) nowait
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const Segment& s = segments[i];
+            if (!lazyMapping)
+                walkRow(s.x, s.y0, s.y1, [&](int y, long n) { number(s.x, y) = n; });
+            classifyRow(s.x, s.y0, s.y1, ColorThreads[tid]);
+            local.add(Chunks);
+            local.add(Pixels, s.y1 - s.y0);
+        }
+        local.addTime(ExecTime, omp_get_wtime() - start);
+        metrics.merge(tid, local);
+    }
+}
+
+void UlamSpiral::setLazyMapping(bool lazy)
+{
+    lazyMapping = lazy;
+    if (lazyMapping) {
+        deleteMatrix();
+    } else if (!Matrix.data()) {
+        allocMatrix();
+        applyMapping();
+    }
+}
+
+void UlamSpiral::setOrigin(long cx, long cy)
+{
+    originX = cx;
+    originY = cy;
+    if (!lazyMapping)
+        applyMapping();
+    resolvePrimeTest();
+}
+
+void UlamSpiral::centerOn(long n)
+{
+    long cx, cy;
+    spiralCoordinates(n, cx, cy);
+    setOrigin(cx, cy);
+}
+
+void UlamSpiral::setPrimeTest(PrimeTest test)
+{
+    primeTest = test;
+    resolvePrimeTest();
+}
+
+void UlamSpiral::resolvePrimeTest()
+{
+    activeTest = primeTest;
+    if (primeTest == PrimeTest::Auto) {
+        uint64_t limit = windowMaxNumber();
+        bool sieveCheaper = limit <= SieveAutoLimit && limit / SieveNumbersPerTest <= uint64_t(Size) * Size;
+        activeTest = sieveCheaper ? PrimeTest::Sieve : PrimeTest::MillerRabin;
+    }
+    // Only numbers above the current limit are sieved, so a growing spiral
+    // extends the sieve by its new rings.
+    if (activeTest == PrimeTest::Sieve && sieve.limit() < uint64_t(windowMaxNumber())) {
+        double start = omp_get_wtime();
+        sieve.extend(windowMaxNumber());
+        sieveTime = omp_get_wtime() - start;
+    }
+}
+
+// The largest number lies on the outermost ring the window reaches.
+long UlamSpiral::windowMaxNumber()
+{
+    long ring = std::max({ std::labs(centredX(0)), std::labs(centredX(Size - 1)), std::labs(centredY(0)),
+        std::labs(centredY(Size - 1)) });
+    return (2 * ring + 1) * (2 * ring + 1);
+}
+
+void UlamSpiral::sievePrimes()
+{
+    double start = omp_get_wtime();
+    sieve.sieve(windowMaxNumber());
+    sieveTime = omp_get_wtime() - start;
 }
 
 void UlamSpiral::mapPrimes(int blockSize)
@@ -176,6 +979,8 @@ void UlamSpiral::mapPrimes(int blockSize)
 #pragma omp parallel
     {
         int tid = omp_get_thread_num();
+        MetricsSlot local;
+        census.record();
 
         double start = omp_get_wtime();
 #pragma omp for collapse(2) schedule(dynamic) nowait
@@ -184,24 +989,16 @@ void UlamSpiral::mapPrimes(int blockSize)
 
                 int iMax = std::min(bi + blockSize, Size);
                 int jMax = std::min(bj + blockSize, Size);
+                local.add(Chunks);
+                local.add(Pixels, long(iMax - bi) * (jMax - bj));
 
-                for (int x = bi; x < iMax; ++x) {
-                    for (int y = bj; y < jMax; ++y) {
-                        if (isPrime(Matrix[x][y])) {
-                            ColorMatrix[x][y][0] = 0;
-                            ColorMatrix[x][y][1] = 0;
-                            ColorMatrix[x][y][2] = 0;
-                        } else {
-                            ColorMatrix[x][y][0] = ColorThreads[tid][0];
-                            ColorMatrix[x][y][1] = ColorThreads[tid][1];
-                            ColorMatrix[x][y][2] = ColorThreads[tid][2];
-                        }
-                    }
-                }
+                for (int x = bi; x < iMax; ++x)
+                    classifyRow(x, bj, jMax, ColorThreads[tid]);
             }
         }
         double end = omp_get_wtime();
-        threadExecTime[tid] = end - start;
+        local.addTime(ExecTime, end - start);
+        metrics.merge(tid, local);
     }
 }
 
@@ -212,6 +1009,7 @@ void UlamSpiral::mapPrimesNest(int block)
     {
         double start = omp_get_wtime();
         int tid1 = omp_get_thread_num();
+        MetricsSlot local;
 
 #pragma omp for collapse(2) nowait
         for (int bi = 0; bi < Size; bi += block) {
@@ -219,23 +1017,26 @@ void UlamSpiral::mapPrimesNest(int block)
 
                 int iMax = std::min(bi + block, Size);
                 int jMax = std::min(bj + block, Size);
+                local.add(Chunks);
+                local.add(Pixels, long(iMax - bi) * (jMax - bj));
 
 #pragma omp parallel
                 {
                     int tid2 = omp_get_thread_num();
+                    census.record();
 
 #pragma omp for collapse(2) nowait
                     for (int x = bi; x < iMax; ++x) {
                         for (int y = bj; y < jMax; ++y) {
 
-                            if (isPrime(Matrix[x][y])) {
-                                ColorMatrix[x][y][0] = 0;
-                                ColorMatrix[x][y][1] = 0;
-                                ColorMatrix[x][y][2] = 0;
+                            unsigned char* c = color(x, y);
+                            long n = lazyMapping ? spiralNumber(centredX(x), centredY(y)) : number(x, y);
+                            if (cellIsPrime(n)) {
+                                c[0] = c[1] = c[2] = 0;
                             } else {
-                                ColorMatrix[x][y][0] = ColorThreads[tid1][0];
-                                ColorMatrix[x][y][1] = ColorThreads[tid1][1];
-                                ColorMatrix[x][y][2] = ColorThreads[tid1][2];
+                                c[0] = ColorThreads[tid1][0];
+                                c[1] = ColorThreads[tid1][1];
+                                c[2] = ColorThreads[tid1][2];
                             }
                         }
                     }
@@ -243,30 +1044,170 @@ void UlamSpiral::mapPrimesNest(int block)
             }
         }
         double end = omp_get_wtime();
-        threadExecTime[tid1] = end - start;
+        local.addTime(ExecTime, end - start);
+        metrics.merge(tid1, local);
     }
 }
-int UlamSpiral::getMapping(int x, int y)
+
+// Tiles of tileRows x tileCols, handed out by a worksharing loop under the
+// given schedule (static, dynamic or guided, one tile per chunk except for
+// static, which splits the tiles evenly) or as tasks (taskloop).
+void UlamSpiral::mapPrimesTiled(int tileRows, int tileCols, const std::string& schedule)
 {
-    x -= (Size - 1) / 2;
-    y -= Size / 2;
-    int mx = abs(x), my = abs(y);
+    int tilesY = (Size + tileCols - 1) / tileCols;
+    int tiles = (Size + tileRows - 1) / tileRows * tilesY;
+    bool tasks = schedule == "taskloop";
+    if (!tasks)
+        applyOpenMP({ schedule, schedule == "static" ? 0 : 1, threadsToUse });
 
-    int l = 2 * std::max(mx, my);
-    int d = y >= x ? l * 3 + x + y : l - x - y;
+    auto tile = [&](int t) {
+        int tid = omp_get_thread_num();
+        int bi = t / tilesY * tileRows, bj = t % tilesY * tileCols;
+        int iMax = std::min(bi + tileRows, Size);
+        int jMax = std::min(bj + tileCols, Size);
+        for (int x = bi; x < iMax; ++x)
+            classifyRow(x, bj, jMax, ColorThreads[tid]);
+        metrics.add(tid, Chunks);
+        metrics.add(tid, Pixels, long(iMax - bi) * (jMax - bj));
+    };
 
-    return std::pow(l - 1, 2) + d;
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        census.record();
+        double start = omp_get_wtime();
+        if (tasks) {
+#pragma omp single
+#pragma omp taskloop grainsize(1)
+            for (int t = 0; t < tiles; ++t)
+                tile(t);
+        } else {
+#pragma omp for schedule(runtime)
+            for (int t = 0; t < tiles; ++t)
+                tile(t);
+        }
+        metrics.addTime(tid, ExecTime, omp_get_wtime() - start);
+    }
 }
 
-void UlamSpiral::applyMapping()
+// The same tiles as mapPrimesNest on a single team: an outer taskloop hands
+// out the blockSize x blockSize tiles and every tile splits its rows into
+// sub-tiles of grain rows, so idle threads pick up sub-tiles of a busy tile
+// instead of a new team being forked for every tile.
+void UlamSpiral::mapPrimesTasks(int block, int grain)
 {
-    for (int x = 0; x < Size; ++x) {
-        for (int y = 0; y < Size; ++y) {
-            Matrix[x][y] = getMapping(x, y);
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        census.record();
+        double start = omp_get_wtime();
+
+#pragma omp single
+#pragma omp taskloop collapse(2) grainsize(1)
+        for (int bi = 0; bi < Size; bi += block) {
+            for (int bj = 0; bj < Size; bj += block) {
+                int iMax = std::min(bi + block, Size);
+                int jMax = std::min(bj + block, Size);
+
+#pragma omp taskloop grainsize(grain)
+                for (int x = bi; x < iMax; ++x) {
+                    int worker = omp_get_thread_num();
+                    classifyRow(x, bj, jMax, ColorThreads[worker]);
+                    metrics.add(worker, Pixels, jMax - bj);
+                }
+                metrics.add(omp_get_thread_num(), Chunks);
+            }
+        }
+
+        metrics.addTime(tid, ExecTime, omp_get_wtime() - start);
+    }
+}
+long UlamSpiral::getMapping(int x, int y)
+{
+    return spiralNumber(centredX(x), centredY(y));
+}
+
+// Calls body(y, n) for y0 <= y < y1 with n the number at (x, y). Along a
+// row the number is linear in y between the diagonals and quadratic
+// outside them, so it is computed directly at the start of each piece and
+// then advanced by finite differences.
+template <typename Body>
+void UlamSpiral::walkRow(int x, int y0, int y1, Body body) const
+{
+    long cx = centredX(x);
+    long a = std::labs(cx);
+    long offset = centredY(0);
+    int y = y0;
+    while (y < y1) {
+        long cy = y + offset;
+        long last, step, growth;
+        if (cy < -a) {
+            last = -a - 1;
+            step = 8 * cy + 5;
+            growth = 8;
+        } else if (cy > a) {
+            last = y1 + offset;
+            step = 8 * cy + 7;
+            growth = 8;
+        } else if (cy >= cx) {
+            last = a;
+            step = 1;
+            growth = 0;
+        } else {
+            last = cx - 1;
+            step = -1;
+            growth = 0;
+        }
+
+        int end = int(std::min<long>(y1, last - offset + 1));
+        long n = spiralNumber(cx, cy);
+        for (; y < end; ++y) {
+            body(y, n);
+            n += step;
+            step += growth;
+        }
+    }
+}
+
+void UlamSpiral::classifyRow(int x, int y0, int y1, const unsigned char* threadColor)
+{
+    auto paint = [&](int y, bool prime) {
+        unsigned char* c = color(x, y);
+        if (prime) {
+            c[0] = c[1] = c[2] = 0;
+        } else {
+            c[0] = threadColor[0];
+            c[1] = threadColor[1];
+            c[2] = threadColor[2];
         }
+    };
+
+    if (activeTest == PrimeTest::MillerRabin) {
+        // The row is gathered first and tested in batches across lanes.
+        std::vector<uint64_t> numbers(y1 - y0);
+        std::unique_ptr<bool[]> prime(new bool[y1 - y0]);
+        if (lazyMapping)
+            walkRow(x, y0, y1, [&](int y, long n) { numbers[y - y0] = n; });
+        else
+            std::copy(&number(x, y0), &number(x, y0) + (y1 - y0), numbers.begin());
+        millerRabinBatch(numbers.data(), y1 - y0, prime.get());
+        for (int y = y0; y < y1; ++y)
+            paint(y, prime[y - y0]);
+    } else if (lazyMapping) {
+        walkRow(x, y0, y1, [&](int y, long n) { paint(y, cellIsPrime(n)); });
+    } else {
+        for (int y = y0; y < y1; ++y)
+            paint(y, cellIsPrime(number(x, y)));
     }
 }
 
+void UlamSpiral::applyMapping()
+{
+#pragma omp parallel for
+    for (int x = 0; x < Size; ++x)
+        walkRow(x, 0, Size, [&](int y, long n) { number(x, y) = n; });
+}
+
 void UlamSpiral::applyColorThreads()
 {
     for (int t = 0; t < threadsToUse; ++t) {
@@ -278,24 +1219,12 @@ void UlamSpiral::applyColorThreads()
 
 void UlamSpiral::allocMatrix()
 {
-    Matrix = new int*[Size];
-    for (int x = 0; x < Size; ++x) {
-        Matrix[x] = new int[Size];
-    }
+    Matrix = HugeBuffer<long>(size_t(Size) * Size);
 }
 
 void UlamSpiral::allocColorMatrix()
 {
-    ColorMatrix = new unsigned char**[Size];
-    for (int x = 0; x < Size; ++x) {
-        ColorMatrix[x] = new unsigned char*[Size];
-        for (int y = 0; y < Size; ++y) {
-            ColorMatrix[x][y] = new unsigned char[3];
-            ColorMatrix[x][y][0] = 0;
-            ColorMatrix[x][y][1] = 0;
-            ColorMatrix[x][y][2] = 0;
-        }
-    }
+    ColorMatrix = HugeBuffer<unsigned char>(size_t(Size) * Size * 3);
 }
 
 void UlamSpiral::allocColorThreads()
@@ -308,21 +1237,12 @@ void UlamSpiral::allocColorThreads()
 
 void UlamSpiral::deleteColorMatrix()
 {
-    for (int x = 0; x < Size; ++x) {
-        for (int y = 0; y < Size; ++y) {
-            delete[] ColorMatrix[x][y];
-        }
-        delete[] ColorMatrix[x];
-    }
-    delete[] ColorMatrix;
+    ColorMatrix.reset();
 }
 
 void UlamSpiral::deleteMatrix()
 {
-    for (int x = 0; x < Size; ++x) {
-        delete[] Matrix[x];
-    }
-    delete[] Matrix;
+    Matrix.reset();
 }
 
 void UlamSpiral::deleteColorThreads()
@@ -337,7 +1257,7 @@ void UlamSpiral::printMatrix()
 {
     for (int x = 0; x < Size; ++x) {
         for (int y = 0; y < Size; ++y) {
-            std::cout << std::setw(4) << Matrix[x][y] << ' ';
+            std::cout << std::setw(4) << (lazyMapping ? getMapping(x, y) : number(x, y)) << ' ';
         }
         std::cout << '\n';
     }
@@ -352,24 +1272,508 @@ void UlamSpiral::saveToPPM(std::string fileName, int scale)
     out << "P6\n"
         << Size * scale << " " << Size * scale << "\n255\n";
 
+    // Every row is scaled once and then written scale times in one call.
+    std::vector<unsigned char> row(size_t(Size) * scale * 3);
     for (int x = 0; x < Size; ++x) {
-        for (int i = 0; i < scale; ++i) {
+        const unsigned char* src = color(x, 0);
+        for (int y = 0; y < Size * scale; ++y)
+            std::copy(src + y / scale * 3, src + y / scale * 3 + 3, row.data() + size_t(y) * 3);
+        for (int i = 0; i < scale; ++i)
+            out.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+
+    out.close();
+}
+
+// P6 with every thread writing its own rows at their offsets: the header
+// and rows have fixed sizes, so row x starts at header + x * scale * row.
+// A scaled row is built once and copied scale times into one block.
+bool UlamSpiral::savePPMParallel(const std::string& fileName, int scale)
+{
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    std::string header = "P6\n" + std::to_string(Size * scale) + " " + std::to_string(Size * scale) + "\n255\n";
+    size_t rowBytes = size_t(Size) * scale * 3;
+    bool ok = pwriteAll(fd, header.data(), header.size(), 0);
+
+#pragma omp parallel reduction(&& : ok)
+    {
+        std::vector<unsigned char> block(rowBytes * scale);
+#pragma omp for schedule(static)
+        for (int x = 0; x < Size; ++x) {
+            const unsigned char* src = color(x, 0);
+            unsigned char* row = block.data();
+            for (int y = 0; y < Size; ++y)
+                for (int j = 0; j < scale; ++j)
+                    memcpy(row + (size_t(y) * scale + j) * 3, src + size_t(y) * 3, 3);
+            for (int i = 1; i < scale; ++i)
+                memcpy(row + i * rowBytes, row, rowBytes);
+            ok = ok && pwriteAll(fd, row, block.size(), off_t(header.size() + size_t(x) * block.size()));
+        }
+    }
+    return close(fd) == 0 && ok;
+}
+
+// P4 mask of the prime (black) cells, one bit per pixel and 1 for black,
+// rows padded to whole bytes; written in parallel like savePPMParallel.
+bool UlamSpiral::savePBM(const std::string& fileName, int scale)
+{
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    std::string header = "P4\n" + std::to_string(Size * scale) + " " + std::to_string(Size * scale) + "\n";
+    size_t rowBytes = (size_t(Size) * scale + 7) / 8;
+    bool ok = pwriteAll(fd, header.data(), header.size(), 0);
+
+#pragma omp parallel reduction(&& : ok)
+    {
+        std::vector<unsigned char> block(rowBytes * scale);
+#pragma omp for schedule(static)
+        for (int x = 0; x < Size; ++x) {
+            unsigned char* row = block.data();
+            std::fill(row, row + rowBytes, 0);
             for (int y = 0; y < Size; ++y) {
+                const unsigned char* c = color(x, y);
+                if (c[0] | c[1] | c[2])
+                    continue;
                 for (int j = 0; j < scale; ++j) {
-                    out.write(reinterpret_cast<char*>(ColorMatrix[x][y]), 3);
+                    size_t bit = size_t(y) * scale + j;
+                    row[bit / 8] |= 0x80 >> (bit % 8);
                 }
             }
+            for (int i = 1; i < scale; ++i)
+                memcpy(row + i * rowBytes, row, rowBytes);
+            ok = ok && pwriteAll(fd, row, block.size(), off_t(header.size() + size_t(x) * block.size()));
         }
     }
+    return close(fd) == 0 && ok;
+}
 
-    out.close();
+void UlamSpiral::saveToPNG(std::string fileName, int scale)
+{
+    writePNGRows(fileName, Size * scale, Size * scale, 3, [&](int row, unsigned char* out) {
+        int x = row / scale;
+        for (int y = 0; y < Size; ++y) {
+            for (int j = 0; j < scale; ++j) {
+                std::copy(color(x, y), color(x, y) + 3, out);
+                out += 3;
+            }
+        }
+    });
+}
+
+SpiralWindow::SpiralWindow(long x0, long y0, int width, int height, int tileSize)
+    : X0(x0)
+    , Y0(y0)
+    , Width(width)
+    , Height(height)
+    , TileSize(tileSize)
+{
+    long ring = std::max({ std::labs(x0), std::labs(x0 + height - 1), std::labs(y0), std::labs(y0 + width - 1) });
+    uint64_t limit = std::min<uint64_t>(uint64_t(2 * ring + 1) * (2 * ring + 1), SieveAutoLimit);
+    primes = PrimeSieve::basePrimes(uint64_t(std::sqrt(double(limit + 128))) + 2);
+    for (uint32_t p : primes)
+        reciprocals.push_back(~uint64_t(0) / p + 1);
 }
 
-bool isPrime(int n)
+bool SpiralWindow::render(const std::string& fileName, int threads)
 {
-    int p;
+    sievedTiles = testedTiles = sievedNumbers = 0;
+    band.assign(size_t(TileSize) * Width * 3, 0);
+    int bandRow = -1;
+
+    // One encoder thread asks for the rows in order, so a band is rendered
+    // (by all threads) once and then consumed row by row.
+    bool ok = writePNGRows(
+        fileName, Width, Height, 3,
+        [&](int r, unsigned char* out) {
+            if (bandRow < 0 || r < bandRow || r >= bandRow + TileSize) {
+                bandRow = r / TileSize * TileSize;
+                renderBand(bandRow, threads);
+            }
+            const unsigned char* row = band.data() + size_t(r - bandRow) * Width * 3;
+            std::copy(row, row + size_t(Width) * 3, out);
+        },
+        1);
+    band.clear();
+    band.shrink_to_fit();
+    return ok;
+}
+
+void SpiralWindow::renderBand(int r0, int threads)
+{
+    int rows = std::min(TileSize, Height - r0);
+    int tiles = (Width + TileSize - 1) / TileSize;
+    long sieved = 0, tested = 0, numbers = 0;
+    size_t peak = peakTileBytes;
+
+#pragma omp parallel num_threads(threads) reduction(+ : sieved, tested, numbers) reduction(max : peak)
+    {
+        int tid = omp_get_thread_num();
+        unsigned char rgb[3] = { (unsigned char)(255 * ((float)tid / threads)), 0, 0 };
+        rgb[2] = 255 - rgb[0];
+        std::vector<Run> runs;
+        std::vector<uint64_t> bits;
+
+#pragma omp for schedule(dynamic)
+        for (int t = 0; t < tiles; ++t) {
+            int c0 = t * TileSize;
+            renderTile(r0, c0, rows, std::min(TileSize, Width - c0), rgb, runs, bits);
+            if (runs.empty()) {
+                ++tested;
+                continue;
+            }
+            ++sieved;
+            for (const Run& run : runs)
+                numbers += run.last - run.first + 1;
+            peak = std::max(peak, bits.capacity() * sizeof(uint64_t) + runs.capacity() * sizeof(Run));
+        }
+    }
+    sievedTiles += sieved;
+    testedTiles += tested;
+    sievedNumbers += numbers;
+    peakTileBytes = peak;
+}
+
+// Every ring k the tile reaches crosses it in at most four straight arms,
+// and the numbers along an arm are consecutive:
+//   right  cx = k,  cy in [-k, k - 1]
+//   bottom cy = -k, cx in [-k + 1, k - 1]
+//   left   cx = -k, cy in [-k, k]
+//   top    cy = k,  cx in [-k + 1, k]
+void SpiralWindow::collectRuns(long cx0, long cx1, long cy0, long cy1, std::vector<Run>& runs)
+{
+    auto gap = [](long lo, long hi) { return lo > 0 ? lo : hi < 0 ? -hi : 0; };
+    long kMin = std::max(gap(cx0, cx1), gap(cy0, cy1));
+    long kMax = std::max({ std::labs(cx0), std::labs(cx1), std::labs(cy0), std::labs(cy1) });
+
+    auto arm = [&](bool fixedX, long fixed, long from, long to) {
+        long lo = std::max(from, fixedX ? cy0 : cx0);
+        long hi = std::min(to, fixedX ? cy1 : cx1);
+        if (lo > hi || fixed < (fixedX ? cx0 : cy0) || fixed > (fixedX ? cx1 : cy1))
+            return;
+        uint64_t a = fixedX ? spiralNumber(fixed, lo) : spiralNumber(lo, fixed);
+        uint64_t b = fixedX ? spiralNumber(fixed, hi) : spiralNumber(hi, fixed);
+        runs.push_back({ std::min(a, b), std::max(a, b), 0, 0 });
+    };
+
+    runs.clear();
+    for (long k = kMin; k <= kMax; ++k) {
+        if (k == 0) {
+            runs.push_back({ 1, 1, 0, 0 });
+            continue;
+        }
+        arm(true, k, -k, k - 1);
+        arm(false, -k, -k + 1, k - 1);
+        arm(true, -k, -k, k);
+        arm(false, k, -k + 1, k);
+    }
+
+    std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (const Run& run : runs) {
+        if (merged > 0 && run.first <= runs[merged - 1].last + 1)
+            runs[merged - 1].last = std::max(runs[merged - 1].last, run.last);
+        else
+            runs[merged++] = run;
+    }
+    runs.resize(merged);
+}
+
+// PrimeSieve::markSegment for runs below 2^32. Runs are short and most
+// base primes have no multiple in them, so finding the first multiple is
+// nearly the whole cost; the remainder is taken with a precomputed
+// reciprocal (Lemire's fastmod) instead of a division.
+void SpiralWindow::markRun(uint64_t* words, size_t count, uint32_t low) const
+{
+    std::fill(words, words + count, ~uint64_t(0));
+    uint64_t high = low + 128 * uint64_t(count);
+    for (size_t i = 0; i < primes.size(); ++i) {
+        uint64_t p = primes[i];
+        if (p * p >= high)
+            break;
+        uint32_t remainder = uint32_t(((unsigned __int128)(reciprocals[i] * low) * p) >> 64);
+        uint64_t first = std::max<uint64_t>(p * p, uint64_t(low) + (remainder ? p - remainder : 0));
+        if (first % 2 == 0)
+            first += p;
+        for (uint64_t m = first; m < high; m += 2 * p) {
+            uint64_t bit = (m - low) >> 1;
+            words[bit >> 6] &= ~(uint64_t(1) << (bit & 63));
+        }
+    }
+}
+
+void SpiralWindow::renderTile(int r0, int c0, int rows, int cols, const unsigned char* rgb, std::vector<Run>& runs,
+    std::vector<uint64_t>& bits)
+{
+    long cx0 = X0 + r0, cy0 = Y0 + c0;
+    long ring = std::max({ std::labs(cx0), std::labs(cx0 + rows - 1), std::labs(cy0), std::labs(cy0 + cols - 1) });
+    bool sieved = uint64_t(2 * ring + 1) * (2 * ring + 1) <= SieveAutoLimit;
+
+    runs.clear();
+    if (sieved) {
+        collectRuns(cx0, cx0 + rows - 1, cy0, cy0 + cols - 1, runs);
+        size_t words = 0;
+        for (Run& run : runs) {
+            run.low = run.first % 2 ? run.first : run.first - 1;
+            run.word = words;
+            words += (run.last - run.low) / 128 + 1;
+        }
+        bits.resize(words);
+        for (const Run& run : runs) {
+            size_t count = (run.last - run.low) / 128 + 1;
+            markRun(bits.data() + run.word, count, uint32_t(run.low));
+            if (run.low == 1)
+                bits[run.word] &= ~uint64_t(1);
+        }
+    }
+
+    std::vector<uint64_t> numbers(cols);
+    std::unique_ptr<bool[]> prime(new bool[cols]);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c)
+            numbers[c] = spiralNumber(cx0 + r, cy0 + c);
+        if (sieved) {
+            // Neighbours mostly lie on the same arm, so the last run is
+            // tried before searching.
+            auto run = runs.begin();
+            for (int c = 0; c < cols; ++c) {
+                uint64_t n = numbers[c];
+                if (n < run->first || n > run->last)
+                    run = std::upper_bound(runs.begin(), runs.end(), n,
+                              [](uint64_t value, const Run& run) { return value < run.first; })
+                        - 1;
+                uint64_t bit = (n - run->low) >> 1;
+                prime[c] = n % 2 ? (bits[run->word + bit / 64] >> (bit % 64)) & 1 : n == 2;
+            }
+        } else {
+            millerRabinBatch(numbers.data(), cols, prime.get());
+        }
+
+        unsigned char* out = band.data() + (size_t(r) * Width + c0) * 3;
+        for (int c = 0; c < cols; ++c, out += 3) {
+            const unsigned char black[3] = { 0, 0, 0 };
+            const unsigned char* pixel = prime[c] ? black : rgb;
+            std::copy(pixel, pixel + 3, out);
+        }
+    }
+}
+
+PrimeDensity::PrimeDensity(int size)
+    : Size(size)
+{
+    xLo = -(Size - 1) / 2;
+    xHi = xLo + Size - 1;
+    yLo = -(Size / 2);
+    yHi = yLo + Size - 1;
+    rings = std::max({ -xLo, xHi, -yLo, yHi }) + 1;
+
+    sieve.sieve(uint64_t(2 * rings - 1) * (2 * rings - 1));
+}
+
+// Cells of the window with max(|cx|, |cy|) <= k.
+long PrimeDensity::boxCells(long k) const
+{
+    if (k < 0)
+        return 0;
+    long width = std::max(0L, std::min(xHi, k) - std::max(xLo, -k) + 1);
+    long height = std::max(0L, std::min(yHi, k) - std::max(yLo, -k) + 1);
+    return width * height;
+}
+
+// Ring k holds (2k - 1)^2 + d for 1 <= d <= 8k: the right side from
+// d = 1, then the bottom, left and top sides (see spiralCoordinates).
+void PrimeDensity::countLines()
+{
+    long count = 2 * Size - 1;
+    long diagLo = xLo - yHi, antiLo = xLo + yLo;
+    std::vector<long> diag(count, 0), anti(count, 0), ring(rings, 0);
+    long* d = diag.data();
+    long* a = anti.data();
+    long* r = ring.data();
+    const uint64_t* bits = sieve.bitmap();
+
+    auto add = [&](long k, long cx, long cy) {
+        if (!inside(cx, cy))
+            return;
+        ++d[cx - cy - diagLo];
+        ++a[cx + cy - antiLo];
+        ++r[k];
+    };
+
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : d[:count], a[:count], r[:rings])
+    for (long k = 1; k < rings; ++k) {
+        uint64_t base = uint64_t(2 * k - 1) * (2 * k - 1);
+        uint64_t first = base + 1, last = base + 8 * k;
+        if (k == 1)
+            add(1, 1, 0); // 2, the only even prime, is not in the bitmap
+        for (uint64_t w = first >> 7; w <= last >> 7; ++w) {
+            uint64_t word = bits[w];
+            while (word) {
+                uint64_t n = 128 * w + 2 * __builtin_ctzll(word) + 1;
+                word &= word - 1;
+                if (n < first || n > last)
+                    continue;
+                long off = long(n - base);
+                if (off <= 2 * k)
+                    add(k, k, k - off);
+                else if (off < 4 * k)
+                    add(k, 3 * k - off, -k);
+                else if (off <= 6 * k)
+                    add(k, -k, off - 5 * k);
+                else
+                    add(k, off - 7 * k, k);
+            }
+        }
+    }
+
+    for (long i = 0; i < count; ++i) {
+        long t = diagLo + i;
+        long cells = std::max(0L, std::min(xHi, yHi + t) - std::max(xLo, yLo + t) + 1);
+        lines.push_back({ "Diagonal", t, 0, 0, cells, diag[i] });
+    }
+    for (long i = 0; i < count; ++i) {
+        long t = antiLo + i;
+        long cells = std::max(0L, std::min(xHi, t - yLo) - std::max(xLo, t - yHi) + 1);
+        lines.push_back({ "AntiDiagonal", t, 0, 0, cells, anti[i] });
+    }
+    for (long k = 0; k < rings; ++k)
+        lines.push_back({ "Ring", k, 0, 0, boxCells(k) - boxCells(k - 1), ring[k] });
+}
+
+// Values 4n^2 + bn + c for n >= 0 up to the sieve limit; only values of
+// at least 2 are counted as cells. Each polynomial is a ray of the spiral
+// and every one is counted by one thread, so no reduction is needed.
+void PrimeDensity::countQuadratics(int bRange, int cRange)
+{
+    int bs = 2 * bRange + 1, cs = 2 * cRange + 1;
+    std::vector<DensityLine> quadratics(size_t(bs) * cs);
+    long limit = long(sieve.limit());
+
+#pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int bi = 0; bi < bs; ++bi) {
+        for (int ci = 0; ci < cs; ++ci) {
+            int b = bi - bRange, c = ci - cRange;
+            long cells = 0, primes = 0;
+            long value = c, step = 4 + b; // value(n + 1) - value(n) = 8n + 4 + b
+            for (long n = 0; value <= limit || step <= 0; ++n) {
+                if (value >= 2 && value <= limit) {
+                    ++cells;
+                    primes += sieve.isPrime(value);
+                }
+                value += step;
+                step += 8;
+            }
+            quadratics[size_t(bi) * cs + ci] = { "Quadratic", -1, b, c, cells, primes };
+        }
+    }
+    lines.insert(lines.end(), quadratics.begin(), quadratics.end());
+}
+
+void PrimeDensity::writeCSV(const std::string& fileName)
+{
+    std::ofstream csv(fileName);
+    csv << "Kind,Size,Index,B,C,Cells,Primes,Density\n";
+    for (const DensityLine& line : lines) {
+        bool quadratic = std::string(line.kind) == "Quadratic";
+        csv << line.kind << "," << Size << ",";
+        if (!quadratic)
+            csv << line.index;
+        csv << "," << line.b << "," << line.c << "," << line.cells << "," << line.primes << "," << line.density()
+            << "\n";
+    }
+}
+
+// The k densest lines of every kind among those with at least minCells.
+void PrimeDensity::printTop(std::ostream& out, int k, long minCells)
+{
+    for (const char* kind : { "Diagonal", "AntiDiagonal", "Ring", "Quadratic" }) {
+        std::vector<const DensityLine*> top;
+        for (const DensityLine& line : lines)
+            if (std::string(line.kind) == kind && line.cells >= minCells)
+                top.push_back(&line);
+        std::sort(top.begin(), top.end(),
+            [](const DensityLine* a, const DensityLine* b) { return a->density() > b->density(); });
+        top.resize(std::min<size_t>(top.size(), k));
+
+        out << "Top " << top.size() << " " << kind << " lines:\n";
+        for (const DensityLine* line : top) {
+            out << "  ";
+            if (std::string(kind) == "Quadratic")
+                out << "4n^2 " << (line->b < 0 ? "- " : "+ ") << std::abs(line->b) << "n "
+                    << (line->c < 0 ? "- " : "+ ") << std::abs(line->c);
+            else
+                out << "index " << line->index;
+            out << ": " << line->primes << " / " << line->cells << " = " << line->density() << "\n";
+        }
+    }
+}
+
+bool pwriteAll(int fd, const void* data, size_t bytes, off_t offset)
+{
+    const char* from = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, from, bytes, offset);
+        if (written <= 0)
+            return false;
+        from += written;
+        bytes -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// Number at (cx, cy) relative to the centre of the spiral, where 1 is.
+long spiralNumber(long cx, long cy)
+{
+    long l = 2 * std::max(std::labs(cx), std::labs(cy));
+    long d = cy >= cx ? 3 * l + cx + cy : l - cx - cy;
+    return (l - 1) * (l - 1) + d;
+}
+
+// Inverse of spiralNumber. Ring k holds ((2k - 1)^2, (2k + 1)^2]; the
+// offset d into the ring gives the side and then the position on it.
+void spiralCoordinates(long n, long& cx, long& cy)
+{
+    if (n <= 1) {
+        cx = cy = 0;
+        return;
+    }
+    long root = long(std::sqrt(double(n - 1)));
+    while (root * root > n - 1)
+        --root;
+    while ((root + 1) * (root + 1) <= n - 1)
+        ++root;
+    long k = (root + 1) / 2;
+    long d = n - (2 * k - 1) * (2 * k - 1);
+
+    if (d < 4 * k) {
+        long sum = 2 * k - d; // cy < cx: right or bottom side
+        cx = sum >= 0 ? k : sum + k;
+        cy = sum >= 0 ? sum - k : -k;
+    } else {
+        long sum = d - 6 * k; // cy >= cx: left or top side
+        cx = sum <= 0 ? -k : sum - k;
+        cy = sum <= 0 ? sum + k : k;
+    }
+}
+
+bool isPrime(long n)
+{
+    long p;
     for (p = 2; p * p <= n; p++)
         if (n % p == 0)
             return 0;
-    return n > 2;
+    return n > 1;
+}
+
+size_t residentBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
 }
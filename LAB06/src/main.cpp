@@ -9,6 +9,10 @@
 #include <string>
 #include <vector>
 
+#include "../../common/metrics.hpp"
+#include "../../common/placement.hpp"
+#include "../../common/png_writer.hpp"
+
 enum Direction {
     up = 1,
     down = 2,
@@ -18,6 +22,7 @@ enum Direction {
 };
 
 std::mutex coutMutex;
+Placement placement = Placement::fromEnv();
 
 struct Position {
     Position(const int _y = 0, const int _x = 0)
@@ -116,16 +121,19 @@ public:
     void printStats();
 
     void saveToPPM(const std::string&, const int);
+    void saveToPNG(const std::string&, const int);
 
 private:
     std::vector<std::vector<int>> mazeMatrix;
     std::vector<std::vector<omp_lock_t>> cellLock;
-    std::vector<int> childrenCount;
-    omp_lock_t childrenCountMutex;
+    // Walker i is task i + 1 of the maze; workers are the OpenMP threads
+    // that ran the tasks.
+    ThreadMetrics walkers;
+    ThreadMetrics workers;
     unsigned int threadCounter = 1;
     omp_lock_t threadCounterMutex;
 
-    void threadTraverse(const int, const Position&);
+    void threadTraverse(const int, const Position&, const int);
 
     int getPositionStatus(const Position&);
     void setPositionStatus(const Position&, int);
@@ -138,19 +146,18 @@ private:
     void clear();
 
     void generateDFS(int x, int y);
+    void cellColor(int, unsigned char[3]) const;
 };
 
 Maze::Maze()
 {
     omp_init_lock(&threadCounterMutex);
-    omp_init_lock(&childrenCountMutex);
 }
 
 Maze::~Maze()
 {
     clear();
     omp_destroy_lock(&threadCounterMutex);
-    omp_destroy_lock(&childrenCountMutex);
 }
 
 void Maze::loadFromFile(const std::string& fileName)
@@ -225,13 +232,12 @@ void Maze::printBoard()
 
 void Maze::printStats()
 {
+    std::cout << "Placement: " << placement.name() << std::endl;
     std::cout << "Threads spawned: " << threadCounter - 1 << std::endl;
-    int childrenSum = 0;
-    for (int tid = 0; tid < childrenCount.size(); ++tid) {
-        std::cout << "Thread " << tid + 1 << " had " << childrenCount[tid] << " children" << std::endl;
-        childrenSum += childrenCount[tid];
-    }
-    std::cout << "Control sum: " << childrenSum + 1 << std::endl;
+    for (int tid = 0; tid < int(threadCounter) - 1; ++tid)
+        std::cout << "Thread " << tid + 1 << " had " << walkers.counter(tid, Spawned) << " children" << std::endl;
+    std::cout << "Control sum: " << walkers.total(Spawned) + 1 << std::endl;
+    workers.print(std::cout, "OpenMP thread");
 }
 
 void Maze::run()
@@ -250,11 +256,16 @@ void Maze::run()
     int id = getID();
     trySettingPositionStatus(startingPos, id);
 
+    // Every walker claims at least one free cell, so the cell count bounds
+    // the number of walkers and their slots never have to grow.
+    walkers.reset(int(mazeMatrix.size() * mazeMatrix[0].size()));
+    workers.reset(omp_get_max_threads());
+
 #pragma omp parallel
     {
 #pragma omp single
         {
-            threadTraverse(id, startingPos);
+            threadTraverse(id, startingPos, -1);
         }
     }
 }
@@ -274,18 +285,10 @@ void Maze::saveToPPM(const std::string& fileName, const int scale = 1)
     for (const auto& row : mazeMatrix) {
         for (int i = 0; i < scale; ++i) {
             for (const auto& cell : row) {
-                unsigned r, g, b;
-                if (cell == 0) {
-                    r = g = b = 255;
-                } else if (cell > 0) {
-                    r = (255 / threadCounter) * (cell - 1);
-                    g = 255 - r;
-                    b = 255 - r;
-                } else {
-                    r = g = b = 0;
-                }
+                unsigned char rgb[3];
+                cellColor(cell, rgb);
                 for (int j = 0; j < scale; ++j)
-                    file << r << " " << g << " " << b << " ";
+                    file << unsigned(rgb[0]) << " " << unsigned(rgb[1]) << " " << unsigned(rgb[2]) << " ";
             }
             file << "\n";
         }
@@ -294,11 +297,43 @@ void Maze::saveToPPM(const std::string& fileName, const int scale = 1)
     file.close();
 }
 
-void Maze::threadTraverse(const int tid, const Position& startingPos)
+void Maze::saveToPNG(const std::string& fileName, const int scale = 1)
 {
-    omp_set_lock(&childrenCountMutex);
-    childrenCount.push_back(0);
-    omp_unset_lock(&childrenCountMutex);
+    const int height = int(mazeMatrix.size()) * scale;
+    const int width = int(mazeMatrix[0].size()) * scale;
+
+    writePNGRows(fileName, width, height, 3, [&](int y, unsigned char* out) {
+        const auto& row = mazeMatrix[y / scale];
+        for (size_t x = 0; x < row.size(); ++x) {
+            cellColor(row[x], out);
+            for (int j = 1; j < scale; ++j)
+                std::copy(out, out + 3, out + 3 * j);
+            out += 3 * scale;
+        }
+    });
+}
+
+void Maze::cellColor(int cell, unsigned char rgb[3]) const
+{
+    if (cell == 0) {
+        rgb[0] = rgb[1] = rgb[2] = 255;
+    } else if (cell > 0) {
+        unsigned r = (255 / threadCounter) * (cell - 1);
+        rgb[0] = (unsigned char)r;
+        rgb[1] = (unsigned char)(255 - r);
+        rgb[2] = (unsigned char)(255 - r);
+    } else {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+    }
+}
+
+void Maze::threadTraverse(const int tid, const Position& startingPos, const int spawnedOn)
+{
+    int worker = omp_get_thread_num();
+    MetricsSlot walker, local;
+    local.add(Chunks);
+    if (spawnedOn >= 0 && spawnedOn != worker)
+        local.add(Steals);
 
     Position currentPos(startingPos);
     bool moved = true;
@@ -312,7 +347,7 @@ void Maze::threadTraverse(const int tid, const Position& startingPos)
 
             if (moved) {
                 if (trySpawningThread(next)) {
-                    childrenCount[tid]++;
+                    walker.add(Spawned);
                 }
             } else if (trySettingPositionStatus(next, tid)) {
                 moved = true;
@@ -321,6 +356,8 @@ void Maze::threadTraverse(const int tid, const Position& startingPos)
         }
         currentPos.go(whereToGo);
     }
+    walkers.merge(tid - 1, walker);
+    workers.merge(worker, local);
 
     std::lock_guard<std::mutex> guard(coutMutex);
     std::cout << "Thread: " << tid << " ended" << std::endl;
@@ -362,8 +399,9 @@ bool Maze::trySpawningThread(const Position& pos)
         int id = getID();
         mazeMatrix[pos.y][pos.x] = id;
         omp_unset_lock(&cellLock[pos.y][pos.x]);
+        int spawnedOn = omp_get_thread_num();
 #pragma omp task
-        threadTraverse(id, Position(pos.y, pos.x));
+        threadTraverse(id, Position(pos.y, pos.x), spawnedOn);
         spawned = true;
     }
 
@@ -400,11 +438,14 @@ void Maze::clear()
 
 int main()
 {
+    if (!placement.pinOpenMP())
+        placement.markUnpinned();
+
     Maze maze;
     maze.generateMaze(40, 40);
     maze.run();
     maze.printBoard();
-    maze.saveToPPM("maze.ppm", 16);
+    maze.saveToPNG("maze.png", 16);
     maze.printStats();
 
     return 0;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
@@ -11,6 +12,10 @@
 
 #include "tbb/tbb.h"
 
+#include "../common/huge_buffer.hpp"
+#include "../common/metrics.hpp"
+#include "../common/placement_tbb.hpp"
+
 const int iXmax = 20000;
 const int iYmax = 20000;
 const double CxMin = -2.5;
@@ -22,45 +27,35 @@ const int IterationMax = 500;
 const double EscapeRadius = 2;
 const int nr_threads = 16;
 
-unsigned char color[iYmax][iXmax][3];
-long int sum[nr_threads] = { 0 };
-double threadExecTime[nr_threads] = { 0 };
+// iYmax * iXmax * 3 bytes, too large for 4 KiB pages to stay in the TLB.
+HugeBuffer<unsigned char> colorBuffer;
+unsigned char (*color)[iXmax][3] = nullptr;
+// One slot per TBB thread index of the default arena.
+ThreadMetrics metrics(std::max(nr_threads, tbb::info::default_concurrency()));
 std::mutex mtx;
 int counter = 0;
+Placement placement = Placement::fromEnv();
 
-void mandelbrotThread(int tid, unsigned char* threadColor);
+void mandelbrotThread(const unsigned char* threadColor);
 
 template <typename Func>
 double runExperiment(const std::string& name, Func func, int runs,
-    std::ofstream& csv)
+    const PlacementObserver& observer, std::ofstream& csv)
 {
     double avgTime = 0;
     for (int r = 1; r <= runs; ++r) {
-        for (int i = 0; i < nr_threads; i++)
-            sum[i] = 0;
+        metrics.reset();
         counter = 0;
 
         auto start = std::chrono::steady_clock::now();
-        std::vector<std::thread> threads;
-        unsigned char threadColor[nr_threads][3];
-        for (int i = 0; i < nr_threads; ++i) {
-            threadColor[i][0] = (255 / nr_threads) * i;
-            threadColor[i][1] = 255 - threadColor[i][0];
-            threadColor[i][2] = 0;
-            threads.emplace_back(func, i, threadColor[i]);
-        }
-        for (auto& t : threads)
-            t.join();
+        func();
         auto end = std::chrono::steady_clock::now();
 
         avgTime += std::chrono::duration<double>(end - start).count();
     }
-    csv << name << "," << nr_threads << "," << avgTime / runs << "\n";
-    std::cout << name << ": " << avgTime / runs << " s\n";
-    for (int tid = 0; tid < nr_threads; ++tid) {
-        std::cout << "Thread " << tid << ": " << threadExecTime[tid] << " s"
-                  << std::endl;
-    }
+    csv << name << "," << tbb::info::default_concurrency() << "," << avgTime / runs << "," << observer.name() << "\n";
+    std::cout << name << " (" << observer.name() << "): " << avgTime / runs << " s\n";
+    metrics.print(std::cout);
     std::cout << std::endl;
 
     /**
@@ -80,56 +75,68 @@ double runExperiment(const std::string& name, Func func, int runs,
 
 int main()
 {
+    bool newFile = !std::filesystem::exists("mandelbrot_times_pc.csv");
     std::ofstream csv("mandelbrot_times_pc.csv", std::ios::app);
-    csv << "method,threads,run,time_seconds\n";
+    if (newFile)
+        csv << "method,threads,time_seconds,placement\n";
+    PlacementObserver observer(placement);
+
+    colorBuffer = HugeBuffer<unsigned char>(size_t(iYmax) * iXmax * 3, nr_threads);
+    color = reinterpret_cast<unsigned char(*)[iXmax][3]>(colorBuffer.data());
+    std::cout << "Color buffer: " << colorBuffer.describe() << std::endl;
+
+    const unsigned char threadColor[3] = { 255, 0, 0 };
+    runExperiment("TBB", [&] { mandelbrotThread(threadColor); }, 3, observer, csv);
 
-    mandelbrotThread(1, unsigned char* threadColor)
-        csv.close();
+    csv.close();
     return 0;
 }
 
-void mandelbrotThread(int tid, unsigned char* threadColor)
+void mandelbrotThread(const unsigned char* threadColor)
 {
-    auto start = std::chrono::steady_clock::now();
-    int lowerBound = (iYmax / nr_threads) * tid;
-    int upperBound = lowerBound + (iYmax / nr_threads);
-
-    int iX, iY, Iteration;
-    double Cx, Cy;
     double PixelWidth = (CxMax - CxMin) / iXmax;
     double PixelHeight = (CyMax - CyMin) / iYmax;
-    double Zx, Zy, Zx2, Zy2;
     double ER2 = EscapeRadius * EscapeRadius;
 
+    // Counted per range and merged once into the slot of the TBB thread
+    // that ran it, never per pixel into the shared registry.
     tbb::parallel_for(tbb::blocked_range<int>(0, iYmax),
-        [&](tbb::blocked_range<int> r) {
-            Cy = CyMin + iY * PixelHeight;
-            if (fabs(Cy) < PixelHeight / 2)
-                Cy = 0.0;
-
-            for (iX = 0; iX < iXmax; iX++) {
-                Cx = CxMin + iX * PixelWidth;
-                Zx = Zy = 0.0;
-                Zx2 = Zy2 = 0.0;
-
-                for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
-                    Iteration++) {
-                    Zy = 2 * Zx * Zy + Cy;
-                    Zx = Zx2 - Zy2 + Cx;
-                    Zx2 = Zx * Zx;
-                    Zy2 = Zy * Zy;
-                }
-                sum[tid] += Iteration;
-
-                if (Iteration == IterationMax) {
-                    color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
-                } else {
-                    color[iY][iX][0] = threadColor[0];
-                    color[iY][iX][1] = threadColor[1];
-                    color[iY][iX][2] = threadColor[2];
+        [&](const tbb::blocked_range<int>& r) {
+            auto start = std::chrono::steady_clock::now();
+            MetricsSlot local;
+            for (int iY = r.begin(); iY != r.end(); ++iY) {
+                double Cy = CyMin + iY * PixelHeight;
+                if (fabs(Cy) < PixelHeight / 2)
+                    Cy = 0.0;
+
+                for (int iX = 0; iX < iXmax; iX++) {
+                    double Cx = CxMin + iX * PixelWidth;
+                    double Zx = 0.0, Zy = 0.0;
+                    double Zx2 = 0.0, Zy2 = 0.0;
+
+                    int Iteration;
+                    for (Iteration = 0; Iteration < IterationMax && (Zx2 + Zy2) < ER2;
+                        Iteration++) {
+                        Zy = 2 * Zx * Zy + Cy;
+                        Zx = Zx2 - Zy2 + Cx;
+                        Zx2 = Zx * Zx;
+                        Zy2 = Zy * Zy;
+                    }
+                    local.add(Iterations, Iteration);
+
+                    if (Iteration == IterationMax) {
+                        color[iY][iX][0] = color[iY][iX][1] = color[iY][iX][2] = 0;
+                    } else {
+                        color[iY][iX][0] = threadColor[0];
+                        color[iY][iX][1] = threadColor[1];
+                        color[iY][iX][2] = threadColor[2];
+                    }
                 }
+                local.add(Pixels, iXmax);
             }
+            local.add(Chunks);
+            auto end = std::chrono::steady_clock::now();
+            local.addTime(ExecTime, std::chrono::duration<double>(end - start).count());
+            metrics.merge(tbb::this_task_arena::current_thread_index(), local);
         });
-
-    auto end = std::chrono::steady_clock::now();
 }
@@ -0,0 +1,248 @@
+#pragma once
+
+// C++20: build with -std=c++20 (g++ 10 also needs -fcoroutines).
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "fractal.hpp"
+#include "worker_pool.hpp"
+
+// Asynchronous rendering for services. render() is a lazy coroutine: the
+// frame is split into tiles that run on a shared WorkerPool, the coroutine
+// is suspended until the last tile finishes and then resumed on the worker
+// that finished it. The result owns its iteration buffer.
+//
+//   Task<RenderResult> job = renderer.render(view, options);
+//   RenderResult r = co_await job;       // from another coroutine
+//   std::future<RenderResult> f = startTask(renderer.render(view, options));
+
+template <class T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                std::coroutine_handle<> next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept { }
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task(Task&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        if (handle.promise().error)
+            std::rethrow_exception(handle.promise().error);
+        return std::move(*handle.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h)
+        : handle(h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Fire-and-forget coroutine that frees its own frame when it returns.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Starts a task from ordinary code. The task runs on the calling thread up
+// to its first suspension and continues wherever it is resumed.
+template <class T>
+std::future<T> startTask(Task<T> task)
+{
+    auto promise = std::make_shared<std::promise<T>>();
+    std::future<T> future = promise->get_future();
+    [](Task<T> t, std::shared_ptr<std::promise<T>> p) -> Detached {
+        try {
+            p->set_value(co_await t);
+        } catch (...) {
+            p->set_exception(std::current_exception());
+        }
+    }(std::move(task), promise);
+    return future;
+}
+
+class CancellationToken {
+public:
+    CancellationToken()
+        : flag(std::make_shared<std::atomic<bool>>(false))
+    {
+    }
+
+    void cancel() const { flag->store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return flag->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+// Runs job(0) ... job(count - 1) on the pool and resumes the awaiting
+// coroutine after the last one. A full bounded pool runs the job inline.
+class ParallelFor {
+public:
+    ParallelFor(WorkerPool& pool, int count, std::function<void(int)> job)
+        : Pool(pool)
+        , Count(count)
+        , Job(std::move(job))
+        , remaining(count)
+    {
+    }
+
+    bool await_ready() const noexcept { return Count == 0; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        waiting = h;
+        // The last job resumes the coroutine, which destroys this object,
+        // so nothing here may touch members after the final post.
+        WorkerPool& pool = Pool;
+        int count = Count;
+        for (int i = 0; i < count; ++i) {
+            auto run = [this, i] {
+                Job(i);
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    waiting.resume();
+            };
+            if (!pool.tryPush(run))
+                run();
+        }
+    }
+
+    void await_resume() const noexcept { }
+
+private:
+    WorkerPool& Pool;
+    int Count;
+    std::function<void(int)> Job;
+    std::atomic<int> remaining;
+    std::coroutine_handle<> waiting;
+};
+
+struct TileRect {
+    int x0, y0, x1, y1;
+};
+
+struct RenderOptions {
+    int tileSize = 64;
+    CancellationToken cancel;
+    // Called from a worker thread as soon as a tile is complete, with the
+    // whole frame buffer; only the tile's rectangle is final at that point.
+    std::function<void(const TileRect&, const int* frame, int stride)> onTile;
+};
+
+struct RenderResult {
+    Viewport view;
+    std::vector<int> iterations;
+    int tiles = 0;
+    int tilesRendered = 0;
+    bool cancelled = false;
+};
+
+template <class Formula, class Scalar = double>
+class AsyncRenderer {
+public:
+    AsyncRenderer(WorkerPool& pool, int iterationMax, double escapeRadius = 2, const Formula& formula = Formula())
+        : Pool(pool)
+        , IterationMax(iterationMax)
+        , EscapeRadius(escapeRadius)
+        , F(formula)
+    {
+    }
+
+    // Cancellation is checked before every tile and every row, so a
+    // cancelled request stops within one row per worker.
+    Task<RenderResult> render(Viewport view, RenderOptions options)
+    {
+        EscapeTimeEngine<Formula, Scalar> engine(view, IterationMax, EscapeRadius, F);
+        RenderResult result;
+        result.view = view;
+        result.iterations.assign(size_t(view.iXmax) * view.iYmax, 0);
+
+        int tileSize = std::max(1, options.tileSize);
+        int tilesX = (view.iXmax + tileSize - 1) / tileSize;
+        int tilesY = (view.iYmax + tileSize - 1) / tileSize;
+        result.tiles = tilesX * tilesY;
+        std::atomic<int> rendered { 0 };
+
+        co_await ParallelFor(Pool, result.tiles, [&](int t) {
+            TileRect rect;
+            rect.x0 = (t % tilesX) * tileSize;
+            rect.y0 = (t / tilesX) * tileSize;
+            rect.x1 = std::min(rect.x0 + tileSize, view.iXmax);
+            rect.y1 = std::min(rect.y0 + tileSize, view.iYmax);
+
+            for (int iY = rect.y0; iY < rect.y1; ++iY) {
+                if (options.cancel.cancelled())
+                    return;
+                engine.renderRow(iY, rect.x0, rect.x1, result.iterations.data() + size_t(iY) * view.iXmax + rect.x0);
+            }
+            rendered.fetch_add(1, std::memory_order_relaxed);
+            if (options.onTile)
+                options.onTile(rect, result.iterations.data(), view.iXmax);
+        });
+
+        result.tilesRendered = rendered.load();
+        result.cancelled = result.tilesRendered < result.tiles;
+        co_return result;
+    }
+
+private:
+    WorkerPool& Pool;
+    int IterationMax;
+    double EscapeRadius;
+    Formula F;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Online tuning of (schedule, chunk, threads) by successive halving. Every
+// frame of a job is rendered with current() and its time passed to
+// report(); once all surviving candidates have one more sample, the slower
+// half is dropped. When a single candidate is left it is locked in and
+// stored in a small text database keyed by (workload, size, host), so the
+// next run with the same key starts locked.
+//
+// Database lines: <workload> <size> <host> <schedule> <chunk> <threads> <seconds>
+// The last matching line wins.
+
+struct TuneConfig {
+    std::string schedule;
+    int chunk;
+    int threads;
+
+    std::string name() const { return schedule + "-" + std::to_string(chunk) + "-" + std::to_string(threads) + "t"; }
+
+    bool operator==(const TuneConfig& other) const
+    {
+        return schedule == other.schedule && chunk == other.chunk && threads == other.threads;
+    }
+};
+
+#ifdef _OPENMP
+inline void applyOpenMP(const TuneConfig& config)
+{
+    omp_sched_t kind = omp_sched_static;
+    if (config.schedule == "dynamic")
+        kind = omp_sched_dynamic;
+    else if (config.schedule == "guided")
+        kind = omp_sched_guided;
+    else if (config.schedule == "auto")
+        kind = omp_sched_auto;
+    omp_set_schedule(kind, config.chunk);
+    omp_set_num_threads(config.threads);
+}
+#endif
+
+inline std::string hostName()
+{
+    char name[256] = { 0 };
+    if (gethostname(name, sizeof(name) - 1) != 0 || !name[0])
+        return "localhost";
+    return name;
+}
+
+class AutoTuner {
+public:
+    AutoTuner(const std::string& workload, int size, const std::vector<TuneConfig>& candidates,
+        const std::string& database = "autotune.db")
+        : Workload(workload)
+        , Size(size)
+        , Host(hostName())
+        , Database(database)
+    {
+        for (const TuneConfig& c : candidates)
+            arms.push_back({ c });
+        for (int i = 0; i < int(arms.size()); ++i)
+            alive.push_back(i);
+        load();
+    }
+
+    bool locked() const { return alive.size() == 1; }
+    bool fromDatabase() const { return Loaded; }
+    int remaining() const { return int(alive.size()); }
+
+    // Reports still needed before a candidate is locked in: the rest of this
+    // round, then one per survivor in every later round.
+    int framesToLock() const
+    {
+        if (locked())
+            return 0;
+        int frames = int(alive.size() - position);
+        for (size_t n = (alive.size() + 1) / 2; n > 1; n = (n + 1) / 2)
+            frames += int(n);
+        return frames;
+    }
+
+    const TuneConfig& current() const { return arms[alive[position]].config; }
+
+    // Best candidate so far: the winner once locked, otherwise the lowest
+    // mean among the survivors that already have a sample.
+    const TuneConfig& best() const
+    {
+        int bestArm = alive[0];
+        for (int a : alive)
+            if (arms[a].samples && (!arms[bestArm].samples || arms[a].mean() < arms[bestArm].mean()))
+                bestArm = a;
+        return arms[bestArm].config;
+    }
+
+    void report(double seconds)
+    {
+        Arm& arm = arms[alive[position]];
+        arm.total += seconds;
+        arm.samples++;
+        if (locked())
+            return;
+
+        if (++position < alive.size())
+            return;
+        position = 0;
+        std::stable_sort(alive.begin(), alive.end(), [&](int a, int b) { return arms[a].mean() < arms[b].mean(); });
+        alive.resize((alive.size() + 1) / 2);
+        if (locked())
+            save();
+    }
+
+private:
+    struct Arm {
+        TuneConfig config;
+        double total = 0;
+        int samples = 0;
+
+        double mean() const { return samples ? total / samples : 0; }
+    };
+
+    std::string Workload;
+    int Size;
+    std::string Host;
+    std::string Database;
+    bool Loaded = false;
+
+    std::vector<Arm> arms;
+    std::vector<int> alive;
+    size_t position = 0;
+
+    void load()
+    {
+        std::ifstream in(Database);
+        std::string line;
+        int found = -1;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string workload, host;
+            int size;
+            TuneConfig config;
+            if (!(fields >> workload >> size >> host >> config.schedule >> config.chunk >> config.threads))
+                continue;
+            if (workload != Workload || size != Size || host != Host)
+                continue;
+            for (int i = 0; i < int(arms.size()); ++i)
+                if (arms[i].config == config)
+                    found = i;
+        }
+        if (found >= 0) {
+            alive.assign(1, found);
+            Loaded = true;
+        }
+    }
+
+    void save() const
+    {
+        const Arm& winner = arms[alive[0]];
+        std::ofstream out(Database, std::ios::app);
+        out << Workload << " " << Size << " " << Host << " " << winner.config.schedule << " " << winner.config.chunk
+            << " " << winner.config.threads << " " << winner.mean() << "\n";
+    }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+
+// Escape-time fractal engine shared by the Mandelbrot labs.
+//
+// A formula is a plain struct with two inline members:
+//   init(Px, Py, Zx, Zy, Cx, Cy) - starting orbit point and constant for pixel P
+//   step(Zx, Zy, Cx, Cy)         - one iteration z -> f(z, c)
+// Both are templated on the scalar type, so EscapeTimeEngine<Formula, Scalar>
+// is specialized at compile time and the inner loop has no virtual calls.
+
+struct Viewport {
+    double CxMin = -2.5;
+    double CxMax = 1.5;
+    double CyMin = -2.0;
+    double CyMax = 2.0;
+    int iXmax = 1000;
+    int iYmax = 1000;
+
+    double pixelWidth() const { return (CxMax - CxMin) / iXmax; }
+    double pixelHeight() const { return (CyMax - CyMin) / iYmax; }
+};
+
+struct Mandelbrot {
+    static const char* name() { return "Mandelbrot"; }
+
+    template <class Scalar>
+    void init(Scalar Px, Scalar Py, Scalar& Zx, Scalar& Zy, Scalar& Cx, Scalar& Cy) const
+    {
+        Zx = Zy = 0;
+        Cx = Px;
+        Cy = Py;
+    }
+
+    template <class Scalar>
+    void step(Scalar& Zx, Scalar& Zy, Scalar Cx, Scalar Cy) const
+    {
+        Scalar Zx2 = Zx * Zx;
+        Scalar Zy2 = Zy * Zy;
+        Zy = 2 * Zx * Zy + Cy;
+        Zx = Zx2 - Zy2 + Cx;
+    }
+
+    // d -> (2Z + d) d + dc, see DeepZoomEngine in precision.hpp.
+    template <class Scalar>
+    void perturb(Scalar Zx, Scalar Zy, Scalar& dx, Scalar& dy, Scalar dcx, Scalar dcy) const
+    {
+        Scalar Sx = 2 * Zx + dx;
+        Scalar Sy = 2 * Zy + dy;
+        Scalar t = Sx * dx - Sy * dy + dcx;
+        dy = Sx * dy + Sy * dx + dcy;
+        dx = t;
+    }
+};
+
+struct Julia {
+    double Kx = -0.8;
+    double Ky = 0.156;
+
+    static const char* name() { return "Julia"; }
+
+    template <class Scalar>
+    void init(Scalar Px, Scalar Py, Scalar& Zx, Scalar& Zy, Scalar& Cx, Scalar& Cy) const
+    {
+        Zx = Px;
+        Zy = Py;
+        Cx = Scalar(Kx);
+        Cy = Scalar(Ky);
+    }
+
+    template <class Scalar>
+    void step(Scalar& Zx, Scalar& Zy, Scalar Cx, Scalar Cy) const
+    {
+        Mandelbrot().step(Zx, Zy, Cx, Cy);
+    }
+
+    template <class Scalar>
+    void perturb(Scalar Zx, Scalar Zy, Scalar& dx, Scalar& dy, Scalar dcx, Scalar dcy) const
+    {
+        Mandelbrot().perturb(Zx, Zy, dx, dy, dcx, dcy);
+    }
+};
+
+struct BurningShip {
+    static const char* name() { return "BurningShip"; }
+
+    template <class Scalar>
+    void init(Scalar Px, Scalar Py, Scalar& Zx, Scalar& Zy, Scalar& Cx, Scalar& Cy) const
+    {
+        Mandelbrot().init(Px, Py, Zx, Zy, Cx, Cy);
+    }
+
+    template <class Scalar>
+    void step(Scalar& Zx, Scalar& Zy, Scalar Cx, Scalar Cy) const
+    {
+        Scalar Zx2 = Zx * Zx;
+        Scalar Zy2 = Zy * Zy;
+        Zy = 2 * std::abs(Zx * Zy) + Cy;
+        Zx = Zx2 - Zy2 + Cx;
+    }
+};
+
+struct Tricorn {
+    static const char* name() { return "Tricorn"; }
+
+    template <class Scalar>
+    void init(Scalar Px, Scalar Py, Scalar& Zx, Scalar& Zy, Scalar& Cx, Scalar& Cy) const
+    {
+        Mandelbrot().init(Px, Py, Zx, Zy, Cx, Cy);
+    }
+
+    template <class Scalar>
+    void step(Scalar& Zx, Scalar& Zy, Scalar Cx, Scalar Cy) const
+    {
+        Scalar Zx2 = Zx * Zx;
+        Scalar Zy2 = Zy * Zy;
+        Zy = -2 * Zx * Zy + Cy;
+        Zx = Zx2 - Zy2 + Cx;
+    }
+
+    template <class Scalar>
+    void perturb(Scalar Zx, Scalar Zy, Scalar& dx, Scalar& dy, Scalar dcx, Scalar dcy) const
+    {
+        Scalar Sx = 2 * Zx + dx;
+        Scalar Sy = 2 * Zy + dy;
+        Scalar t = Sx * dx - Sy * dy + dcx;
+        dy = -(Sx * dy + Sy * dx) + dcy;
+        dx = t;
+    }
+};
+
+// z -> z^Degree + c, the power is unrolled at compile time.
+template <int Degree>
+struct Multibrot {
+    static_assert(Degree >= 2, "Multibrot degree must be at least 2");
+
+    static const char* name()
+    {
+        static const std::string n = "Multibrot" + std::to_string(Degree);
+        return n.c_str();
+    }
+
+    template <class Scalar>
+    void init(Scalar Px, Scalar Py, Scalar& Zx, Scalar& Zy, Scalar& Cx, Scalar& Cy) const
+    {
+        Mandelbrot().init(Px, Py, Zx, Zy, Cx, Cy);
+    }
+
+    template <class Scalar>
+    void step(Scalar& Zx, Scalar& Zy, Scalar Cx, Scalar Cy) const
+    {
+        Scalar Px = Zx, Py = Zy;
+        for (int d = 1; d < Degree; ++d) {
+            Scalar t = Px * Zx - Py * Zy;
+            Py = Px * Zy + Py * Zx;
+            Px = t;
+        }
+        Zx = Px + Cx;
+        Zy = Py + Cy;
+    }
+};
+
+template <class Formula, class Scalar = double>
+class EscapeTimeEngine {
+public:
+    // One batch fills a 512-bit register, so float gets twice the lanes.
+    static constexpr int Lanes = 8 * sizeof(double) / sizeof(Scalar);
+
+    EscapeTimeEngine(const Viewport& view, int iterationMax, double escapeRadius = 2,
+        const Formula& formula = Formula())
+        : View(view)
+        , IterationMax(iterationMax)
+        , ER2(Scalar(escapeRadius * escapeRadius))
+        , PixelWidth(view.pixelWidth())
+        , PixelHeight(view.pixelHeight())
+        , F(formula)
+    {
+    }
+
+    const Viewport& viewport() const { return View; }
+    const Formula& formula() const { return F; }
+    int iterationMax() const { return IterationMax; }
+
+    Scalar cx(int iX) const { return Scalar(View.CxMin + iX * PixelWidth); }
+
+    Scalar cy(int iY) const
+    {
+        double Cy = View.CyMin + iY * PixelHeight;
+        if (std::fabs(Cy) < PixelHeight / 2)
+            Cy = 0.0;
+        return Scalar(Cy);
+    }
+
+    int iterate(int iX, int iY) const
+    {
+        Scalar Zx, Zy, Cx, Cy;
+        F.init(cx(iX), cy(iY), Zx, Zy, Cx, Cy);
+
+        int Iteration;
+        for (Iteration = 0; Iteration < IterationMax && (Zx * Zx + Zy * Zy) < ER2;
+            Iteration++) {
+            F.step(Zx, Zy, Cx, Cy);
+        }
+        return Iteration;
+    }
+
+    // Iteration counts for pixels [x0, x1) of row iY. Pixels are processed
+    // Lanes at a time with a per-lane escape mask so the compiler can keep
+    // the whole batch in vector registers. Returns the sum of the counts.
+    long renderRow(int iY, int x0, int x1, int* iterations) const
+    {
+        long rowSum = 0;
+        const Scalar Py = cy(iY);
+
+        int iX = x0;
+        for (; iX + Lanes <= x1; iX += Lanes) {
+            Scalar Zx[Lanes], Zy[Lanes], Cx[Lanes], Cy[Lanes];
+            int It[Lanes];
+
+            for (int l = 0; l < Lanes; ++l) {
+                F.init(cx(iX + l), Py, Zx[l], Zy[l], Cx[l], Cy[l]);
+                It[l] = 0;
+            }
+
+            for (int i = 0; i < IterationMax; ++i) {
+                int active = 0;
+#pragma omp simd reduction(+ : active)
+                for (int l = 0; l < Lanes; ++l) {
+                    Scalar x = Zx[l], y = Zy[l];
+                    int alive = (x * x + y * y) < ER2;
+                    F.step(x, y, Cx[l], Cy[l]);
+                    Zx[l] = alive ? x : Zx[l];
+                    Zy[l] = alive ? y : Zy[l];
+                    It[l] += alive;
+                    active += alive;
+                }
+                if (active == 0)
+                    break;
+            }
+
+            for (int l = 0; l < Lanes; ++l) {
+                iterations[iX + l - x0] = It[l];
+                rowSum += It[l];
+            }
+        }
+
+        for (; iX < x1; ++iX) {
+            iterations[iX - x0] = iterate(iX, iY);
+            rowSum += iterations[iX - x0];
+        }
+        return rowSum;
+    }
+
+private:
+    Viewport View;
+    int IterationMax;
+    Scalar ER2;
+    double PixelWidth;
+    double PixelHeight;
+    Formula F;
+};
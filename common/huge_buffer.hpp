@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Large zero-initialized buffer backed by 2 MiB pages when the system allows
+// it. Explicit huge pages (MAP_HUGETLB) are tried first; without a hugetlbfs
+// pool the buffer is mapped 2 MiB aligned and marked MADV_HUGEPAGE so the
+// kernel can back it with transparent huge pages. If both are refused it is
+// an ordinary 4 KiB page mapping.
+//
+// HUGEPAGES=off in the environment skips both, for comparison runs.
+
+const size_t HugePageSize = size_t(2) << 20;
+
+enum class HugePages {
+    None,
+    Transparent,
+    Explicit
+};
+
+inline const char* hugePagesName(HugePages pages)
+{
+    switch (pages) {
+    case HugePages::Explicit:
+        return "hugetlb";
+    case HugePages::Transparent:
+        return "thp";
+    default:
+        return "4k";
+    }
+}
+
+template <class T>
+class HugeBuffer {
+public:
+    HugeBuffer() = default;
+
+    // Pages are touched by prefaultThreads threads in parallel so the page
+    // faults are not paid inside the timed region; 0 leaves them lazy.
+    explicit HugeBuffer(size_t count, int prefaultThreads = std::thread::hardware_concurrency())
+        : Count(count)
+    {
+        Bytes = (std::max<size_t>(count * sizeof(T), 1) + HugePageSize - 1) / HugePageSize * HugePageSize;
+        const char* env = std::getenv("HUGEPAGES");
+        bool allowed = !env || std::string(env) != "off";
+
+        if (allowed)
+            mapExplicit();
+        if (!Data)
+            mapAligned(allowed);
+        if (prefaultThreads > 0)
+            prefault(prefaultThreads);
+    }
+
+    ~HugeBuffer() { reset(); }
+
+    HugeBuffer(const HugeBuffer&) = delete;
+    HugeBuffer& operator=(const HugeBuffer&) = delete;
+
+    HugeBuffer(HugeBuffer&& other) noexcept { *this = std::move(other); }
+    HugeBuffer& operator=(HugeBuffer&& other) noexcept
+    {
+        std::swap(Data, other.Data);
+        std::swap(Count, other.Count);
+        std::swap(Bytes, other.Bytes);
+        std::swap(Pages, other.Pages);
+        return *this;
+    }
+
+    void reset()
+    {
+        if (Data)
+            munmap(Data, Bytes);
+        Data = nullptr;
+        Count = Bytes = 0;
+        Pages = HugePages::None;
+    }
+
+    T* data() const { return Data; }
+    size_t size() const { return Count; }
+    T& operator[](size_t i) const { return Data[i]; }
+
+    // What was requested from the kernel. Transparent huge pages are only
+    // a hint, hugeBytes() tells how much of the buffer they actually cover.
+    HugePages pages() const { return Pages; }
+
+    size_t hugeBytes() const
+    {
+        if (Pages == HugePages::Explicit)
+            return Bytes;
+        if (Pages == HugePages::None)
+            return 0;
+
+        // The mapping may have been split by the kernel, so every smaps
+        // entry inside [Data, Data + Bytes) is counted.
+        uintptr_t begin = reinterpret_cast<uintptr_t>(Data), end = begin + Bytes;
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        bool inside = false;
+        size_t kib = 0;
+        while (std::getline(smaps, line)) {
+            unsigned long from, to;
+            if (sscanf(line.c_str(), "%lx-%lx ", &from, &to) == 2) {
+                inside = from >= begin && to <= end;
+            } else if (inside && line.rfind("AnonHugePages:", 0) == 0) {
+                kib += std::strtoul(line.c_str() + 14, nullptr, 10);
+            }
+        }
+        return kib << 10;
+    }
+
+    // One line for the benchmark output, e.g. "thp 1144/1146 MiB".
+    std::string describe() const
+    {
+        std::ostringstream out;
+        out << hugePagesName(Pages) << " " << (hugeBytes() >> 20) << "/" << (Bytes >> 20) << " MiB";
+        return out.str();
+    }
+
+private:
+    T* Data = nullptr;
+    size_t Count = 0;
+    size_t Bytes = 0;
+    HugePages Pages = HugePages::None;
+
+    void mapExplicit()
+    {
+        void* p = mmap(nullptr, Bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            Data = static_cast<T*>(p);
+            Pages = HugePages::Explicit;
+        }
+    }
+
+    // Over-allocate by one huge page and trim both ends so the buffer
+    // starts on a 2 MiB boundary, otherwise THP cannot cover its head.
+    void mapAligned(bool advise)
+    {
+        size_t padded = Bytes + HugePageSize;
+        void* p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        uintptr_t raw = reinterpret_cast<uintptr_t>(p);
+        uintptr_t aligned = (raw + HugePageSize - 1) & ~(HugePageSize - 1);
+        if (aligned > raw)
+            munmap(p, aligned - raw);
+        if (raw + padded > aligned + Bytes)
+            munmap(reinterpret_cast<void*>(aligned + Bytes), raw + padded - aligned - Bytes);
+
+        Data = reinterpret_cast<T*>(aligned);
+        if (advise && madvise(Data, Bytes, MADV_HUGEPAGE) == 0)
+            Pages = HugePages::Transparent;
+    }
+
+    void prefault(int threads)
+    {
+        // A transparent huge page may still be refused at fault time, so
+        // every base page is touched unless the mapping is hugetlb.
+        size_t step = Pages == HugePages::Explicit ? HugePageSize : size_t(sysconf(_SC_PAGESIZE));
+        size_t pages = Bytes / step;
+        threads = int(std::min<size_t>(threads, pages));
+        char* base = reinterpret_cast<char*>(Data);
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([=] {
+                for (size_t page = pages * t / threads; page < pages * (t + 1) / threads; ++page)
+                    base[page * step] = 0;
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+    }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+// Per-thread statistics without false sharing. Every thread owns one
+// cache-line-aligned MetricsSlot; hot loops accumulate into a local slot and
+// store it once at the end, and totals are summed only after the threads
+// have joined, so no locks or atomics are needed anywhere.
+
+const int CacheLine = 64;
+
+enum Counter {
+    Iterations,
+    Pixels,
+    Chunks,
+    Steals,
+    Spawned,
+    CounterCount
+};
+
+enum Timer {
+    ExecTime,
+    WaitTime,
+    TimerCount
+};
+
+inline const char* counterName(Counter c)
+{
+    static const char* names[CounterCount] = { "iterations", "pixels", "chunks", "steals", "spawned" };
+    return names[c];
+}
+
+inline const char* timerName(Timer t)
+{
+    static const char* names[TimerCount] = { "exec", "wait" };
+    return names[t];
+}
+
+struct alignas(CacheLine) MetricsSlot {
+    long counters[CounterCount] = { 0 };
+    double timers[TimerCount] = { 0 };
+
+    void add(Counter c, long n = 1) { counters[c] += n; }
+    void addTime(Timer t, double seconds) { timers[t] += seconds; }
+
+    void merge(const MetricsSlot& other)
+    {
+        for (int c = 0; c < CounterCount; ++c)
+            counters[c] += other.counters[c];
+        for (int t = 0; t < TimerCount; ++t)
+            timers[t] += other.timers[t];
+    }
+};
+
+static_assert(sizeof(MetricsSlot) % CacheLine == 0, "slots must not share cache lines");
+
+class ThreadMetrics {
+public:
+    explicit ThreadMetrics(int threads = 0)
+        : slots(threads)
+    {
+    }
+
+    // Drops all values; resizing is not safe while threads are recording.
+    void reset(int threads)
+    {
+        slots.assign(threads, MetricsSlot());
+    }
+    void reset() { reset(this->threads()); }
+
+    int threads() const { return int(slots.size()); }
+
+    MetricsSlot& operator[](int tid) { return slots[tid]; }
+    const MetricsSlot& operator[](int tid) const { return slots[tid]; }
+
+    void add(int tid, Counter c, long n = 1) { slots[tid].add(c, n); }
+    void addTime(int tid, Timer t, double seconds) { slots[tid].addTime(t, seconds); }
+    void merge(int tid, const MetricsSlot& local) { slots[tid].merge(local); }
+
+    long counter(int tid, Counter c) const { return slots[tid].counters[c]; }
+    double time(int tid, Timer t) const { return slots[tid].timers[t]; }
+
+    long total(Counter c) const
+    {
+        long sum = 0;
+        for (const MetricsSlot& s : slots)
+            sum += s.counters[c];
+        return sum;
+    }
+
+    double total(Timer t) const
+    {
+        double sum = 0;
+        for (const MetricsSlot& s : slots)
+            sum += s.timers[t];
+        return sum;
+    }
+
+    double max(Timer t) const
+    {
+        double m = 0;
+        for (const MetricsSlot& s : slots)
+            m = std::max(m, s.timers[t]);
+        return m;
+    }
+
+    // One line per thread, listing only the metrics some thread recorded.
+    void print(std::ostream& out, const char* label = "Thread") const
+    {
+        bool usedCounter[CounterCount] = { false };
+        bool usedTimer[TimerCount] = { false };
+        for (const MetricsSlot& s : slots) {
+            for (int c = 0; c < CounterCount; ++c)
+                usedCounter[c] |= s.counters[c] != 0;
+            for (int t = 0; t < TimerCount; ++t)
+                usedTimer[t] |= s.timers[t] != 0;
+        }
+
+        for (int tid = 0; tid < threads(); ++tid) {
+            out << label << " " << tid;
+            for (int c = 0; c < CounterCount; ++c)
+                if (usedCounter[c])
+                    out << ", " << counterName(Counter(c)) << ": " << slots[tid].counters[c];
+            for (int t = 0; t < TimerCount; ++t)
+                if (usedTimer[t])
+                    out << ", " << timerName(Timer(t)) << ": " << slots[tid].timers[t] << " s";
+            out << "\n";
+        }
+    }
+
+private:
+    std::vector<MetricsSlot> slots;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Deterministic Miller-Rabin for every 64-bit n. The seven bases below
+// (Jim Sinclair's set) have no strong pseudoprime under 2^64. Modular
+// products use Montgomery multiplication, so a test is a chain of 64x64
+// multiplications with no division. Hardware has no vector 64-bit high
+// multiply, so the batch form runs MillerRabinLanes independent tests in
+// lock step instead: their multiplication chains interleave and keep the
+// multiplier busy.
+
+const int MillerRabinLanes = 4;
+
+struct Montgomery {
+    uint64_t n;
+    uint64_t inv; // n^-1 mod 2^64
+    uint64_t r2; // 2^128 mod n
+    uint64_t one; // 2^64 mod n, 1 in Montgomery form
+
+    explicit Montgomery(uint64_t modulus = 1)
+        : n(modulus)
+    {
+        inv = n;
+        for (int i = 0; i < 5; ++i)
+            inv *= 2 - n * inv;
+        one = (0 - n) % n;
+        r2 = uint64_t((unsigned __int128)one * one % n);
+    }
+
+    uint64_t reduce(unsigned __int128 t) const
+    {
+        uint64_t m = uint64_t(t) * inv;
+        uint64_t hi = uint64_t(t >> 64);
+        uint64_t mn = uint64_t(((unsigned __int128)m * n) >> 64);
+        return hi >= mn ? hi - mn : hi - mn + n;
+    }
+
+    uint64_t mul(uint64_t a, uint64_t b) const { return reduce((unsigned __int128)a * b); }
+    uint64_t to(uint64_t a) const { return mul(a % n, r2); }
+};
+
+const uint64_t MillerRabinBases[7] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+
+// Settles small, even and small-factor n; returns -1 if a full test is needed.
+inline int millerRabinPrefilter(uint64_t n)
+{
+    static const uint64_t small[] = { 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47 };
+    if (n < 2)
+        return 0;
+    if (n % 2 == 0)
+        return n == 2;
+    for (uint64_t p : small)
+        if (n % p == 0)
+            return n == p;
+    if (n < 53 * 53)
+        return 1;
+    return -1;
+}
+
+// Full test of odd n > 53^2 with no factor below 53.
+inline bool millerRabinOdd(uint64_t n)
+{
+    Montgomery m(n);
+    uint64_t d = n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+    uint64_t minusOne = n - m.one;
+
+    for (uint64_t base : MillerRabinBases) {
+        uint64_t a = base % n;
+        if (a == 0)
+            continue;
+        uint64_t b = m.to(a), x = m.one;
+        for (uint64_t e = d; e; e >>= 1) {
+            if (e & 1)
+                x = m.mul(x, b);
+            b = m.mul(b, b);
+        }
+        if (x == m.one || x == minusOne)
+            continue;
+        bool composite = true;
+        for (int i = 1; i < s && composite; ++i) {
+            x = m.mul(x, x);
+            composite = x != minusOne;
+        }
+        if (composite)
+            return false;
+    }
+    return true;
+}
+
+inline bool millerRabin(uint64_t n)
+{
+    int settled = millerRabinPrefilter(n);
+    return settled >= 0 ? settled : millerRabinOdd(n);
+}
+
+// Miller-Rabin to the given bases on lanes numbers at once, in lock step.
+inline void millerRabinLanes(const uint64_t* v, int lanes, const uint64_t* bases, int baseCount, bool* prime)
+{
+    Montgomery m[MillerRabinLanes];
+    uint64_t d[MillerRabinLanes], minusOne[MillerRabinLanes];
+    int s[MillerRabinLanes];
+    int bits = 0;
+    for (int l = 0; l < lanes; ++l) {
+        m[l] = Montgomery(v[l]);
+        s[l] = __builtin_ctzll(v[l] - 1);
+        d[l] = (v[l] - 1) >> s[l];
+        minusOne[l] = v[l] - m[l].one;
+        prime[l] = true;
+        bits = std::max(bits, 64 - __builtin_clzll(d[l]));
+    }
+
+    for (int k = 0; k < baseCount; ++k) {
+        if (std::none_of(prime, prime + lanes, [](bool p) { return p; }))
+            return;
+        uint64_t x[MillerRabinLanes], b[MillerRabinLanes];
+        for (int l = 0; l < lanes; ++l) {
+            b[l] = m[l].to(bases[k] % v[l]);
+            x[l] = m[l].one;
+        }
+        for (int bit = 0; bit < bits; ++bit) {
+            for (int l = 0; l < lanes; ++l) {
+                uint64_t product = m[l].mul(x[l], b[l]);
+                x[l] = (d[l] >> bit) & 1 ? product : x[l];
+                b[l] = m[l].mul(b[l], b[l]);
+            }
+        }
+        for (int l = 0; l < lanes; ++l) {
+            if (!prime[l] || bases[k] % v[l] == 0 || x[l] == m[l].one || x[l] == minusOne[l])
+                continue;
+            bool composite = true;
+            for (int i = 1; i < s[l] && composite; ++i) {
+                x[l] = m[l].mul(x[l], x[l]);
+                composite = x[l] != minusOne[l];
+            }
+            prime[l] = !composite;
+        }
+    }
+}
+
+// prime[i] = millerRabin(n[i]) for count numbers. Numbers the prefilter
+// cannot settle are tested to base 2 MillerRabinLanes at a time; the few
+// that pass are almost all prime, so they are regrouped and run through
+// the remaining bases together, and no lane idles on a dead test.
+inline void millerRabinBatch(const uint64_t* n, int count, bool* prime)
+{
+    int first[MillerRabinLanes], second[MillerRabinLanes];
+    int firstLanes = 0, secondLanes = 0;
+
+    auto runSecond = [&] {
+        uint64_t values[MillerRabinLanes] = { 0 };
+        bool pass[MillerRabinLanes];
+        for (int l = 0; l < secondLanes; ++l)
+            values[l] = n[second[l]];
+        millerRabinLanes(values, secondLanes, MillerRabinBases + 1, 6, pass);
+        for (int l = 0; l < secondLanes; ++l)
+            prime[second[l]] = pass[l];
+        secondLanes = 0;
+    };
+    auto runFirst = [&] {
+        uint64_t values[MillerRabinLanes] = { 0 };
+        bool pass[MillerRabinLanes];
+        for (int l = 0; l < firstLanes; ++l)
+            values[l] = n[first[l]];
+        millerRabinLanes(values, firstLanes, MillerRabinBases, 1, pass);
+        for (int l = 0; l < firstLanes; ++l) {
+            prime[first[l]] = false;
+            if (!pass[l])
+                continue;
+            second[secondLanes++] = first[l];
+            if (secondLanes == MillerRabinLanes)
+                runSecond();
+        }
+        firstLanes = 0;
+    };
+
+    for (int i = 0; i < count; ++i) {
+        int settled = millerRabinPrefilter(n[i]);
+        if (settled >= 0) {
+            prime[i] = settled;
+            continue;
+        }
+        first[firstLanes++] = i;
+        if (firstLanes == MillerRabinLanes)
+            runFirst();
+    }
+    if (firstLanes)
+        runFirst();
+    if (secondLanes)
+        runSecond();
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Thread placement shared by every backend. The CPUs in the process's
+// affinity mask, with their topology from /sys/devices/system/cpu, are
+// turned into an ordered list of CPUs; thread t is pinned to
+// order[t % order.size()]. A pin that fails turns the placement into
+// unpinned, so result rows never claim a placement the threads did not get.
+//
+// The policy comes from the PLACEMENT environment variable:
+//   unpinned   - leave placement to the OS scheduler (default)
+//   compact    - fill all SMT siblings of a core before the next core
+//   scatter    - spread over packages and cores first, siblings last
+//   physical   - one SMT sibling per core only
+//   list:0,2,4 - explicit CPU list, ranges like 0-3 are allowed
+
+struct CpuInfo {
+    int cpu;
+    int core;
+    int package;
+};
+
+inline std::vector<int> parseCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty())
+            continue;
+        size_t dash = item.find('-');
+        int first = std::atoi(item.c_str());
+        int last = dash == std::string::npos ? first : std::atoi(item.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// CPUs this process may run on. Under taskset or a cpuset these are fewer
+// than the online CPUs, and pinning to the others fails. Read on first use,
+// normally while constructing a global Placement before any thread is
+// pinned; later the calling thread's own mask would be read instead.
+inline const std::vector<int>& allowedCpus()
+{
+    static const std::vector<int> allowed = [] {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        std::vector<int> cpus;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            return cpus;
+        }
+        std::ifstream onlineFile("/sys/devices/system/cpu/online");
+        std::string online;
+        std::getline(onlineFile, online);
+        return parseCpuList(online);
+    }();
+    return allowed;
+}
+
+inline std::vector<CpuInfo> readTopology()
+{
+    const std::string root = "/sys/devices/system/cpu/";
+    std::vector<CpuInfo> cpus;
+    for (int cpu : allowedCpus()) {
+        std::string dir = root + "cpu" + std::to_string(cpu) + "/topology/";
+        int core = cpu, package = 0;
+        std::ifstream(dir + "core_id") >> core;
+        std::ifstream(dir + "physical_package_id") >> package;
+        cpus.push_back({ cpu, core, package });
+    }
+    return cpus;
+}
+
+class Placement {
+public:
+    enum Policy {
+        Unpinned,
+        Compact,
+        Scatter,
+        Physical,
+        List
+    };
+
+    explicit Placement(const std::string& spec = "unpinned")
+        : policy(Unpinned)
+    {
+        std::vector<CpuInfo> topology = readTopology();
+
+        // Sibling CPUs of every physical core, cores in (package, core) order.
+        std::map<std::pair<int, int>, std::vector<int>> cores;
+        for (const CpuInfo& c : topology)
+            cores[{ c.package, c.core }].push_back(c.cpu);
+
+        if (spec == "compact") {
+            policy = Compact;
+            for (auto& [id, siblings] : cores)
+                order.insert(order.end(), siblings.begin(), siblings.end());
+        } else if (spec == "physical") {
+            policy = Physical;
+            for (auto& [id, siblings] : cores)
+                order.push_back(siblings.front());
+        } else if (spec == "scatter") {
+            policy = Scatter;
+            std::map<int, std::vector<std::vector<int>>> packages;
+            size_t maxCores = 0, maxSiblings = 0;
+            for (auto& [id, siblings] : cores) {
+                packages[id.first].push_back(siblings);
+                maxCores = std::max(maxCores, packages[id.first].size());
+                maxSiblings = std::max(maxSiblings, siblings.size());
+            }
+            for (size_t s = 0; s < maxSiblings; ++s)
+                for (size_t c = 0; c < maxCores; ++c)
+                    for (auto& [package, packageCores] : packages)
+                        if (c < packageCores.size() && s < packageCores[c].size())
+                            order.push_back(packageCores[c][s]);
+        } else if (spec.rfind("list:", 0) == 0) {
+            policy = List;
+            order = parseCpuList(spec.substr(5));
+        }
+        if (order.empty())
+            policy = Unpinned;
+    }
+
+    static Placement fromEnv(const char* variable = "PLACEMENT")
+    {
+        const char* spec = std::getenv(variable);
+        return Placement(spec ? spec : "unpinned");
+    }
+
+    // Short name for result rows, without commas so it fits in a CSV field.
+    std::string name() const
+    {
+        switch (policy) {
+        case Compact:
+            return "compact";
+        case Scatter:
+            return "scatter";
+        case Physical:
+            return "physical";
+        case List: {
+            std::string n = "list:";
+            for (size_t i = 0; i < order.size(); ++i)
+                n += (i ? "+" : "") + std::to_string(order[i]);
+            return n;
+        }
+        default:
+            return "unpinned";
+        }
+    }
+
+    bool pinned() const { return policy != Unpinned; }
+
+    int cpuFor(int tid) const { return pinned() ? order[tid % order.size()] : -1; }
+
+    // Same order as an OMP_PLACES value, for launching with OMP_PROC_BIND.
+    std::string ompPlaces() const
+    {
+        std::string places;
+        for (size_t i = 0; i < order.size(); ++i)
+            places += (i ? ",{" : "{") + std::to_string(order[i]) + "}";
+        return places;
+    }
+
+    // False if the thread could not be placed as name() says; callers then
+    // call markUnpinned(). Always succeeds for the unpinned policy.
+    bool pinThread(pthread_t thread, int tid) const
+    {
+        if (!pinned())
+            return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpuFor(tid), &set);
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+    }
+
+    bool pinCurrentThread(int tid) const { return pinThread(pthread_self(), tid); }
+
+    // Gives the thread every CPU of the process back.
+    static bool releaseThread(pthread_t thread)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : allowedCpus())
+            CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+    }
+
+    void markUnpinned()
+    {
+        if (!pinned())
+            return;
+        std::cerr << "Placement " << name() << " could not be applied, recording unpinned\n";
+        policy = Unpinned;
+        order.clear();
+    }
+
+#ifdef _OPENMP
+    // OMP_PLACES is read when the runtime starts, before main, so the team
+    // is pinned from inside a parallel region instead. The runtime keeps
+    // its threads between regions, so this holds until the team size
+    // changes and has to be repeated after omp_set_num_threads. False if
+    // any thread of the team could not be pinned. Under the unpinned policy
+    // the team is released instead, in case an earlier placement pinned it.
+    bool pinOpenMP() const
+    {
+        bool ok = true;
+#pragma omp parallel reduction(&& : ok)
+        ok = pinned() ? pinCurrentThread(omp_get_thread_num()) : releaseThread(pthread_self());
+        return ok;
+    }
+#endif
+
+private:
+    Policy policy;
+    std::vector<int> order;
+};
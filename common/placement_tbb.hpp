@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include "tbb/tbb.h"
+
+#include "placement.hpp"
+
+// Pins every thread that joins the default TBB arena. The arena slot index
+// is stable per thread, so slot i gets the placement's i-th CPU.
+class PlacementObserver : public tbb::task_scheduler_observer {
+public:
+    explicit PlacementObserver(const Placement& placement)
+        : placement(placement)
+    {
+        if (placement.pinned())
+            observe(true);
+    }
+
+    ~PlacementObserver() { observe(false); }
+
+    void on_scheduler_entry(bool) override
+    {
+        if (!placement.pinCurrentThread(tbb::this_task_arena::current_thread_index()))
+            pinFailed = true;
+    }
+
+    // The placement's name, or unpinned once any thread failed to pin.
+    std::string name() const { return pinFailed ? "unpinned" : placement.name(); }
+
+private:
+    Placement placement;
+    std::atomic<bool> pinFailed { false };
+};
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "placement.hpp"
+
+// 8-bit PNG writer that encodes horizontal strips in parallel, the way pigz
+// does for gzip. Every strip is filtered and deflated on its own thread with
+// no shared dictionary; all strips except the last end with a sync flush, so
+// the compressed strips concatenate into one valid zlib stream. Each strip is
+// written as its own IDAT chunk and the Adler-32 of the whole stream is
+// combined from the per-strip checksums. At most threads strips are in
+// memory at a time, the rest is streamed to disk.
+//
+// zlib is used when <zlib.h> is available (link with -lz); without it, or
+// with PNG_NO_ZLIB defined, a built-in fixed-Huffman LZ77 deflate is used.
+
+#if !defined(PNG_NO_ZLIB) && __has_include(<zlib.h>)
+#include <zlib.h>
+#define PNG_HAVE_ZLIB 1
+#endif
+
+// Raw bytes per strip. Smaller strips parallelize better but each one
+// restarts the LZ77 window, which costs compression.
+const size_t PngStripBytes = size_t(1) << 20;
+
+inline uint32_t pngCrc32(uint32_t crc, const unsigned char* data, size_t n)
+{
+#ifdef PNG_HAVE_ZLIB
+    return uint32_t(crc32(crc, data, uInt(n)));
+#else
+    static uint32_t table[256] = { 0 };
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+#endif
+}
+
+const uint32_t AdlerBase = 65521;
+
+inline uint32_t pngAdler32(uint32_t adler, const unsigned char* data, size_t n)
+{
+#ifdef PNG_HAVE_ZLIB
+    while (n > 0) {
+        uInt step = uInt(std::min<size_t>(n, 1u << 30));
+        adler = uint32_t(::adler32(adler, data, step));
+        data += step;
+        n -= step;
+    }
+    return adler;
+#else
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (n > 0) {
+        size_t step = std::min<size_t>(n, 5552);
+        for (size_t i = 0; i < step; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= AdlerBase;
+        b %= AdlerBase;
+        data += step;
+        n -= step;
+    }
+    return a | (b << 16);
+#endif
+}
+
+// Adler-32 of A followed by B, from adler(A), adler(B) and the length of B.
+inline uint32_t adler32Combine(uint32_t adlerA, uint32_t adlerB, size_t lengthB)
+{
+    uint64_t rem = lengthB % AdlerBase;
+    uint64_t a = adlerA & 0xffff;
+    uint64_t b = (rem * a) % AdlerBase;
+    a += (adlerB & 0xffff) + AdlerBase - 1;
+    b += (adlerA >> 16) + (adlerB >> 16) + AdlerBase - rem;
+    return uint32_t(a % AdlerBase) | uint32_t(b % AdlerBase) << 16;
+}
+
+inline void putBigEndian(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+inline void appendChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t n)
+{
+    putBigEndian(out, uint32_t(n));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + n);
+    putBigEndian(out, pngCrc32(0, out.data() + start, n + 4));
+}
+
+inline int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+// Writes the filter byte and the filtered row to out, choosing the filter
+// with the smallest sum of absolute values as libpng does. prev is null
+// for the first row of the image.
+inline void filterRow(const unsigned char* row, const unsigned char* prev, size_t rowBytes, int bpp,
+    unsigned char* out, std::vector<unsigned char>& scratch)
+{
+    scratch.resize(5 * rowBytes);
+    long best = -1;
+    int bestFilter = 0;
+    for (int f = 0; f < 5; ++f) {
+        unsigned char* dst = scratch.data() + f * rowBytes;
+        long cost = 0;
+        for (size_t i = 0; i < rowBytes; ++i) {
+            int a = i >= size_t(bpp) ? row[i - bpp] : 0;
+            int b = prev ? prev[i] : 0;
+            int c = prev && i >= size_t(bpp) ? prev[i - bpp] : 0;
+            int predicted = f == 1 ? a : f == 2 ? b : f == 3 ? (a + b) / 2 : f == 4 ? paeth(a, b, c) : 0;
+            dst[i] = (unsigned char)(row[i] - predicted);
+            cost += std::abs((signed char)dst[i]);
+        }
+        if (best < 0 || cost < best) {
+            best = cost;
+            bestFilter = f;
+        }
+    }
+    out[0] = (unsigned char)bestFilter;
+    memcpy(out + 1, scratch.data() + bestFilter * rowBytes, rowBytes);
+}
+
+#ifndef PNG_HAVE_ZLIB
+class DeflateBits {
+public:
+    explicit DeflateBits(std::vector<unsigned char>& out)
+        : out(out)
+    {
+    }
+
+    void put(uint32_t value, int n)
+    {
+        bits |= uint64_t(value) << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((unsigned char)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes are stored most significant bit first.
+    void putCode(uint32_t code, int n)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < n; ++i)
+            reversed |= ((code >> i) & 1) << (n - 1 - i);
+        put(reversed, n);
+    }
+
+    void align()
+    {
+        if (count)
+            put(0, 8 - count);
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    uint64_t bits = 0;
+    int count = 0;
+};
+
+inline void putFixedSymbol(DeflateBits& bits, int symbol)
+{
+    if (symbol < 144)
+        bits.putCode(0x30 + symbol, 8);
+    else if (symbol < 256)
+        bits.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        bits.putCode(symbol - 256, 7);
+    else
+        bits.putCode(0xc0 + symbol - 280, 8);
+}
+
+// One fixed-Huffman block with greedy hash-chain matching.
+inline void deflateFixed(const unsigned char* data, size_t n, bool last, std::vector<unsigned char>& out)
+{
+    static const int lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67,
+        83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5,
+        5, 5, 0 };
+    static const int distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const int distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11,
+        11, 12, 12, 13, 13 };
+    const int hashBits = 15, maxChain = 16, window = 32768, maxMatch = 258;
+
+    DeflateBits bits(out);
+    bits.put(last ? 1 : 0, 1);
+    bits.put(1, 2);
+
+    std::vector<int> head(1 << hashBits, -1), prev(n, -1);
+    auto hash = [&](size_t i) {
+        return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1 << hashBits) - 1);
+    };
+    auto insert = [&](size_t i) {
+        if (i + 3 <= n) {
+            int h = hash(i);
+            prev[i] = head[h];
+            head[h] = int(i);
+        }
+    };
+
+    for (size_t i = 0; i < n;) {
+        int bestLength = 0, bestDistance = 0;
+        if (i + 3 <= n) {
+            int limit = int(std::min<size_t>(maxMatch, n - i));
+            int chain = 0;
+            for (int cand = head[hash(i)]; cand >= 0 && int(i) - cand <= window && chain < maxChain;
+                 cand = prev[cand], ++chain) {
+                int length = 0;
+                while (length < limit && data[cand + length] == data[i + length])
+                    ++length;
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = int(i) - cand;
+                    if (length == limit)
+                        break;
+                }
+            }
+        }
+
+        if (bestLength >= 3) {
+            int l = 28;
+            while (lengthBase[l] > bestLength)
+                --l;
+            putFixedSymbol(bits, 257 + l);
+            bits.put(bestLength - lengthBase[l], lengthExtra[l]);
+            int d = 29;
+            while (distBase[d] > bestDistance)
+                --d;
+            bits.putCode(d, 5);
+            bits.put(bestDistance - distBase[d], distExtra[d]);
+            for (int k = 0; k < bestLength; ++k)
+                insert(i + k);
+            i += bestLength;
+        } else {
+            putFixedSymbol(bits, data[i]);
+            insert(i);
+            ++i;
+        }
+    }
+    putFixedSymbol(bits, 256);
+
+    if (!last) {
+        // Sync flush: an empty stored block brings the stream to a byte
+        // boundary so the next strip can start a fresh block.
+        bits.put(0, 3);
+        bits.align();
+        out.insert(out.end(), { 0x00, 0x00, 0xff, 0xff });
+    } else {
+        bits.align();
+    }
+}
+#endif
+
+// Raw deflate of one strip, ending with a sync flush unless it is the last.
+inline void deflateStrip(const unsigned char* data, size_t n, bool last, int level, std::vector<unsigned char>& out)
+{
+#ifdef PNG_HAVE_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_FILTERED);
+    size_t start = out.size();
+    out.resize(start + deflateBound(&zs, uLong(n)) + 64);
+    zs.next_in = const_cast<unsigned char*>(data);
+    zs.avail_in = uInt(n);
+    zs.next_out = out.data() + start;
+    zs.avail_out = uInt(out.size() - start);
+    deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    out.resize(start + zs.total_out);
+    deflateEnd(&zs);
+#else
+    (void)level;
+    deflateFixed(data, n, last, out);
+#endif
+}
+
+// Encodes a width x height image with 1 (gray), 3 (RGB) or 4 (RGBA)
+// channels. fill(y, row) must write the width * channels bytes of row y; it
+// is called from several threads at once and may be called for a row more
+// than once. Returns false if the file cannot be written. With a placement,
+// the encoder for strip slot t is pinned like thread t, and a failed pin
+// marks the placement unpinned.
+template <typename RowFunc>
+bool writePNGRows(const std::string& fileName, int width, int height, int channels, RowFunc fill,
+    int threads = std::thread::hardware_concurrency(), int level = 6, Placement* placement = nullptr)
+{
+    FILE* fp = fopen(fileName.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> header(signature, signature + 8);
+    std::vector<unsigned char> ihdr;
+    putBigEndian(ihdr, uint32_t(width));
+    putBigEndian(ihdr, uint32_t(height));
+    int colorType = channels == 1 ? 0 : channels == 4 ? 6 : 2;
+    ihdr.insert(ihdr.end(), { 8, (unsigned char)colorType, 0, 0, 0 });
+    appendChunk(header, "IHDR", ihdr.data(), ihdr.size());
+    fwrite(header.data(), 1, header.size(), fp);
+
+    size_t rowBytes = size_t(width) * channels;
+    int stripRows = int(std::max<size_t>(1, PngStripBytes / (rowBytes + 1)));
+    int strips = (height + stripRows - 1) / stripRows;
+    threads = std::max(1, std::min(threads, strips));
+
+    std::vector<std::vector<unsigned char>> chunks(threads);
+    std::vector<uint32_t> adlers(threads);
+    std::vector<size_t> lengths(threads);
+    uint32_t adler = 1;
+    std::atomic<bool> pinFailed { false };
+
+    for (int first = 0; first < strips; first += threads) {
+        int count = std::min(threads, strips - first);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < count; ++t) {
+            workers.emplace_back([&, t] {
+                if (placement && !placement->pinCurrentThread(t))
+                    pinFailed = true;
+                int strip = first + t;
+                int y0 = strip * stripRows, y1 = std::min(y0 + stripRows, height);
+                std::vector<unsigned char> rows((y1 - y0 + 1) * rowBytes), scratch;
+                std::vector<unsigned char> filtered(size_t(y1 - y0) * (rowBytes + 1));
+                if (y0 > 0)
+                    fill(y0 - 1, rows.data());
+                for (int y = y0; y < y1; ++y) {
+                    unsigned char* row = rows.data() + (y - y0 + 1) * rowBytes;
+                    fill(y, row);
+                    filterRow(row, y > 0 ? row - rowBytes : nullptr, rowBytes, channels,
+                        filtered.data() + (y - y0) * (rowBytes + 1), scratch);
+                }
+                adlers[t] = pngAdler32(1, filtered.data(), filtered.size());
+                lengths[t] = filtered.size();
+
+                std::vector<unsigned char> data;
+                if (strip == 0)
+                    data.insert(data.end(), { 0x78, 0x9c });
+                deflateStrip(filtered.data(), filtered.size(), strip == strips - 1, level, data);
+                chunks[t].clear();
+                appendChunk(chunks[t], "IDAT", data.data(), data.size());
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+
+        for (int t = 0; t < count; ++t) {
+            fwrite(chunks[t].data(), 1, chunks[t].size(), fp);
+            adler = adler32Combine(adler, adlers[t], lengths[t]);
+        }
+    }
+
+    std::vector<unsigned char> trailer, tail;
+    putBigEndian(trailer, adler);
+    appendChunk(tail, "IDAT", trailer.data(), trailer.size());
+    appendChunk(tail, "IEND", nullptr, 0);
+    fwrite(tail.data(), 1, tail.size(), fp);
+
+    if (pinFailed)
+        placement->markUnpinned();
+
+    bool ok = !ferror(fp);
+    return fclose(fp) == 0 && ok;
+}
+
+inline bool writePNG(const std::string& fileName, const unsigned char* pixels, int width, int height,
+    int channels = 3, int threads = std::thread::hardware_concurrency(), Placement* placement = nullptr)
+{
+    size_t rowBytes = size_t(width) * channels;
+    return writePNGRows(
+        fileName, width, height, channels,
+        [&](int y, unsigned char* row) { memcpy(row, pixels + y * rowBytes, rowBytes); }, threads, 6,
+        placement);
+}
@@ -0,0 +1,410 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fractal.hpp"
+
+// Precision tiers for the escape-time engine:
+//   Float  - EscapeTimeEngine<Formula, float>, twice the lanes of double
+//   Double - EscapeTimeEngine<Formula, double>
+//   Deep   - DeepZoomEngine<Formula>, a double-double reference orbit with
+//            per-pixel perturbation and series approximation in doubles
+
+enum class PrecisionTier {
+    Float,
+    Double,
+    Deep
+};
+
+inline const char* tierName(PrecisionTier tier)
+{
+    switch (tier) {
+    case PrecisionTier::Float:
+        return "float";
+    case PrecisionTier::Double:
+        return "double";
+    default:
+        return "deep";
+    }
+}
+
+// Pixel spacing relative to the magnitude of the coordinates in view. A
+// tier is usable while that ratio stays well above its machine epsilon.
+inline PrecisionTier selectPrecision(double centerX, double centerY, double halfWidth, double pixelSize)
+{
+    const double FloatLimit = 1e-4;
+    const double DoubleLimit = 1e-13;
+
+    double scale = std::max({ std::fabs(centerX), std::fabs(centerY), halfWidth });
+    double relative = pixelSize / scale;
+
+    if (relative > FloatLimit)
+        return PrecisionTier::Float;
+    if (relative > DoubleLimit)
+        return PrecisionTier::Double;
+    return PrecisionTier::Deep;
+}
+
+inline PrecisionTier selectPrecision(const Viewport& view)
+{
+    return selectPrecision((view.CxMin + view.CxMax) / 2, (view.CyMin + view.CyMax) / 2,
+        (view.CxMax - view.CxMin) / 2, std::min(view.pixelWidth(), view.pixelHeight()));
+}
+
+///////////////////////////////////////////
+
+// Unevaluated sum hi + lo, about 106 bits of mantissa. Relies on fma and
+// IEEE rounding, so do not build with -ffast-math.
+struct DoubleDouble {
+    double hi = 0;
+    double lo = 0;
+
+    DoubleDouble() = default;
+    DoubleDouble(double h)
+        : hi(h)
+    {
+    }
+    DoubleDouble(double h, double l)
+        : hi(h)
+        , lo(l)
+    {
+    }
+
+    explicit operator double() const { return hi + lo; }
+
+    static DoubleDouble quickTwoSum(double a, double b)
+    {
+        double s = a + b;
+        return { s, b - (s - a) };
+    }
+
+    static DoubleDouble twoSum(double a, double b)
+    {
+        double s = a + b;
+        double bb = s - a;
+        return { s, (a - (s - bb)) + (b - bb) };
+    }
+
+    static DoubleDouble twoProd(double a, double b)
+    {
+        double p = a * b;
+        return { p, std::fma(a, b, -p) };
+    }
+
+    // Decimal string such as "-1.7499999999999999998e-1".
+    static DoubleDouble parse(const char* text);
+};
+
+inline DoubleDouble operator-(const DoubleDouble& a) { return { -a.hi, -a.lo }; }
+
+inline DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b)
+{
+    DoubleDouble s = DoubleDouble::twoSum(a.hi, b.hi);
+    DoubleDouble t = DoubleDouble::twoSum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = DoubleDouble::quickTwoSum(s.hi, s.lo);
+    s.lo += t.lo;
+    return DoubleDouble::quickTwoSum(s.hi, s.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b) { return a + -b; }
+
+inline DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b)
+{
+    DoubleDouble p = DoubleDouble::twoProd(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return DoubleDouble::quickTwoSum(p.hi, p.lo);
+}
+
+inline DoubleDouble operator/(const DoubleDouble& a, double b)
+{
+    double q1 = a.hi / b;
+    DoubleDouble r = a - DoubleDouble::twoProd(q1, b);
+    double q2 = r.hi / b;
+    return DoubleDouble::quickTwoSum(q1, q2);
+}
+
+inline bool operator<(const DoubleDouble& a, const DoubleDouble& b)
+{
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+inline DoubleDouble abs(const DoubleDouble& a) { return a.hi < 0 ? -a : a; }
+
+inline DoubleDouble DoubleDouble::parse(const char* text)
+{
+    DoubleDouble value;
+    bool negative = false;
+    int exponent = 0;
+    bool fraction = false;
+
+    if (*text == '-' || *text == '+')
+        negative = *text++ == '-';
+    for (; *text; ++text) {
+        if (std::isdigit(static_cast<unsigned char>(*text))) {
+            value = value * 10.0 + double(*text - '0');
+            if (fraction)
+                --exponent;
+        } else if (*text == '.') {
+            fraction = true;
+        } else if (*text == 'e' || *text == 'E') {
+            exponent += std::atoi(text + 1);
+            break;
+        }
+    }
+    for (; exponent > 0; --exponent)
+        value = value * 10.0;
+    for (; exponent < 0; ++exponent)
+        value = value / 10.0;
+    return negative ? -value : value;
+}
+
+///////////////////////////////////////////
+
+// Formulas that can be rendered by DeepZoomEngine provide
+//   perturb(Zx, Zy, dx, dy, dcx, dcy)
+// which advances the offset d of a pixel orbit from the reference orbit Z
+// without the cancellation of computing f(Z + d) - f(Z) directly.
+
+template <class Formula, class = void>
+struct HasPerturbation : std::false_type {
+};
+
+template <class Formula>
+struct HasPerturbation<Formula,
+    std::void_t<decltype(std::declval<const Formula&>().perturb(0.0, 0.0,
+        std::declval<double&>(), std::declval<double&>(), 0.0, 0.0))>> : std::true_type {
+};
+
+// The series approximation expands the pixel orbit in powers of dc, which
+// only holds for formulas that are holomorphic in c with z0 = 0.
+template <class Formula>
+struct HasSeriesApproximation : std::false_type {
+};
+
+template <>
+struct HasSeriesApproximation<Mandelbrot> : std::true_type {
+};
+
+struct DeepViewport {
+    DoubleDouble Cx;
+    DoubleDouble Cy;
+    double PixelSize = 4.0 / 1000;
+    int iXmax = 1000;
+    int iYmax = 1000;
+
+    DeepViewport() = default;
+    DeepViewport(DoubleDouble cx, DoubleDouble cy, double pixelSize, int width, int height)
+        : Cx(cx)
+        , Cy(cy)
+        , PixelSize(pixelSize)
+        , iXmax(width)
+        , iYmax(height)
+    {
+    }
+    explicit DeepViewport(const Viewport& view)
+        : Cx((DoubleDouble(view.CxMin) + view.CxMax) / 2)
+        , Cy((DoubleDouble(view.CyMin) + view.CyMax) / 2)
+        , PixelSize(view.pixelWidth())
+        , iXmax(view.iXmax)
+        , iYmax(view.iYmax)
+    {
+    }
+
+    // Double precision approximation, only for code that needs the extents.
+    Viewport viewport() const
+    {
+        double cx = double(Cx), cy = double(Cy);
+        return { cx - PixelSize * iXmax / 2, cx + PixelSize * iXmax / 2,
+            cy - PixelSize * iYmax / 2, cy + PixelSize * iYmax / 2, iXmax, iYmax };
+    }
+};
+
+inline PrecisionTier selectPrecision(const DeepViewport& view)
+{
+    return selectPrecision(double(view.Cx), double(view.Cy), view.PixelSize * view.iXmax / 2, view.PixelSize);
+}
+
+template <class Formula>
+class DeepZoomEngine {
+    static_assert(HasPerturbation<Formula>::value, "Formula has no perturbation step");
+
+public:
+    DeepZoomEngine(const DeepViewport& view, int iterationMax, double escapeRadius = 2,
+        const Formula& formula = Formula())
+        : View(view)
+        , Approx(view.viewport())
+        , IterationMax(iterationMax)
+        , ER2(escapeRadius * escapeRadius)
+        , F(formula)
+    {
+        computeReferenceOrbit();
+        computeSeries();
+    }
+
+    const Viewport& viewport() const { return Approx; }
+    const Formula& formula() const { return F; }
+    int iterationMax() const { return IterationMax; }
+    int seriesSkip() const { return Skip; }
+
+    int iterate(int iX, int iY) const
+    {
+        double dcx = (iX - View.iXmax / 2.0) * View.PixelSize;
+        double dcy = (iY - View.iYmax / 2.0) * View.PixelSize;
+        double dx, dy, cdx, cdy, zx0, zy0, cx0, cy0;
+        F.init(dcx, dcy, dx, dy, cdx, cdy);
+        F.init(0.0, 0.0, zx0, zy0, cx0, cy0);
+        dx -= zx0;
+        dy -= zy0;
+        cdx -= cx0;
+        cdy -= cy0;
+
+        int m = 0;
+        if (Skip > 0) {
+            std::complex<double> dc(dcx, dcy);
+            std::complex<double> d = dc * (A + dc * (B + dc * C));
+            dx = d.real();
+            dy = d.imag();
+            m = Skip;
+        }
+
+        // Orbit offsets are rebased onto the start of the reference whenever
+        // the pixel orbit gets closer to zero than its offset, or the
+        // reference escapes first. This also takes care of glitches.
+        const int refEnd = int(RefX.size()) - 1;
+        int Iteration;
+        for (Iteration = m; Iteration < IterationMax; Iteration++) {
+            double Zx = RefX[m] + dx;
+            double Zy = RefY[m] + dy;
+            double z2 = Zx * Zx + Zy * Zy;
+            if (z2 >= ER2)
+                break;
+            if (z2 < dx * dx + dy * dy || m == refEnd) {
+                dx = Zx - RefX[0];
+                dy = Zy - RefY[0];
+                m = 0;
+            }
+            F.perturb(RefX[m], RefY[m], dx, dy, cdx, cdy);
+            ++m;
+        }
+        return Iteration;
+    }
+
+    long renderRow(int iY, int x0, int x1, int* iterations) const
+    {
+        long rowSum = 0;
+        for (int iX = x0; iX < x1; ++iX) {
+            iterations[iX - x0] = iterate(iX, iY);
+            rowSum += iterations[iX - x0];
+        }
+        return rowSum;
+    }
+
+private:
+    DeepViewport View;
+    Viewport Approx;
+    int IterationMax;
+    double ER2;
+    Formula F;
+
+    std::vector<double> RefX;
+    std::vector<double> RefY;
+
+    int Skip = 0;
+    std::complex<double> A, B, C;
+
+    void computeReferenceOrbit()
+    {
+        DoubleDouble Zx, Zy, Cx, Cy;
+        F.init(View.Cx, View.Cy, Zx, Zy, Cx, Cy);
+
+        RefX.reserve(IterationMax + 1);
+        RefY.reserve(IterationMax + 1);
+        RefX.push_back(double(Zx));
+        RefY.push_back(double(Zy));
+        for (int n = 0; n < IterationMax; ++n) {
+            F.step(Zx, Zy, Cx, Cy);
+            double x = double(Zx), y = double(Zy);
+            RefX.push_back(x);
+            RefY.push_back(y);
+            if (x * x + y * y >= ER2)
+                break;
+        }
+    }
+
+    void computeSeries()
+    {
+        if constexpr (HasSeriesApproximation<Formula>::value) {
+            const double Tolerance = 1e-6;
+            double dmax = View.PixelSize * std::hypot(View.iXmax, View.iYmax) / 2;
+
+            std::complex<double> a(0), b(0), c(0);
+            for (int n = 0; n + 1 < int(RefX.size()) - 1; ++n) {
+                std::complex<double> Z(RefX[n], RefY[n]);
+                std::complex<double> na = 2.0 * Z * a + 1.0;
+                std::complex<double> nb = 2.0 * Z * b + a * a;
+                std::complex<double> nc = 2.0 * Z * c + 2.0 * a * b;
+
+                if (std::abs(nc) * dmax > Tolerance * std::abs(nb))
+                    break;
+                a = na;
+                b = nb;
+                c = nc;
+                Skip = n + 1;
+            }
+            A = a;
+            B = b;
+            C = c;
+        }
+    }
+};
+
+///////////////////////////////////////////
+
+// Calls func(engine) with the engine for the requested tier. Formulas
+// without a perturbation step fall back to the double tier.
+template <class Formula, class Func>
+void withPrecision(PrecisionTier tier, const Viewport& view, int iterationMax, double escapeRadius,
+    const Formula& formula, Func&& func)
+{
+    if (tier == PrecisionTier::Float) {
+        EscapeTimeEngine<Formula, float> engine(view, iterationMax, escapeRadius, formula);
+        func(engine);
+        return;
+    }
+    if constexpr (HasPerturbation<Formula>::value) {
+        if (tier == PrecisionTier::Deep) {
+            DeepZoomEngine<Formula> engine(DeepViewport(view), iterationMax, escapeRadius, formula);
+            func(engine);
+            return;
+        }
+    } else if (tier == PrecisionTier::Deep) {
+        std::cerr << Formula::name() << " has no deep zoom tier, using double\n";
+    }
+    EscapeTimeEngine<Formula, double> engine(view, iterationMax, escapeRadius, formula);
+    func(engine);
+}
+
+// Same, for a view whose centre is only exact in double-double. The float
+// and double tiers see its rounded extents; the deep tier keeps the centre.
+template <class Formula, class Func>
+void withPrecision(PrecisionTier tier, const DeepViewport& view, int iterationMax, double escapeRadius,
+    const Formula& formula, Func&& func)
+{
+    if constexpr (HasPerturbation<Formula>::value) {
+        if (tier == PrecisionTier::Deep) {
+            DeepZoomEngine<Formula> engine(view, iterationMax, escapeRadius, formula);
+            func(engine);
+            return;
+        }
+    }
+    withPrecision(tier, view.viewport(), iterationMax, escapeRadius, formula, std::forward<Func>(func));
+}
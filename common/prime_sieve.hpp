@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Segmented Sieve of Eratosthenes over odd numbers, one bit per number.
+// Bit i of word w stands for 128 * w + 2 * i + 1. Segments are whole words
+// and small enough to stay in L1/L2 while the base primes are crossed off,
+// and every segment is written by one thread only, so segments are sieved
+// in parallel without synchronization.
+
+const int SieveSegmentBytes = 32 * 1024;
+const int SieveWordsPerSegment = SieveSegmentBytes / 8;
+
+class PrimeSieve {
+public:
+    PrimeSieve() = default;
+    explicit PrimeSieve(uint64_t limit) { sieve(limit); }
+
+    // Primality of every n in [0, limit].
+    void sieve(uint64_t limit)
+    {
+        words.clear();
+        Limit = 0;
+        extend(limit);
+    }
+
+    // Sieves only the words above the current limit; the rest is kept.
+    void extend(uint64_t limit)
+    {
+        if (!words.empty() && limit <= Limit)
+            return;
+        size_t from = words.size();
+        size_t to = size_t(limit / 128 + 1);
+        // Base primes must cover the whole last word, not only limit,
+        // so that a later extend() can start on the next word.
+        std::vector<uint32_t> primes = basePrimes(uint64_t(std::sqrt(double(to * 128))) + 1);
+
+        words.resize(to);
+        long segments = long((to - from + SieveWordsPerSegment - 1) / SieveWordsPerSegment);
+#pragma omp parallel for schedule(dynamic)
+        for (long s = 0; s < segments; ++s) {
+            size_t w0 = from + size_t(s) * SieveWordsPerSegment;
+            size_t w1 = std::min(w0 + SieveWordsPerSegment, to);
+            markSegment(words.data() + w0, w1 - w0, 128 * uint64_t(w0) + 1, primes);
+        }
+        if (from == 0)
+            words[0] &= ~uint64_t(1); // 1 is not prime
+        Limit = limit;
+    }
+
+    uint64_t limit() const { return Limit; }
+    size_t bytes() const { return words.size() * sizeof(uint64_t); }
+    // Bit i of word w is set if 128 * w + 2 * i + 1 is prime.
+    const uint64_t* bitmap() const { return words.data(); }
+
+    bool isPrime(uint64_t n) const
+    {
+        if (n % 2 == 0)
+            return n == 2;
+        return (words[n >> 7] >> ((n >> 1) & 63)) & 1;
+    }
+
+    // Primes in [3, upTo) by a plain sieve, for crossing off segments.
+    static std::vector<uint32_t> basePrimes(uint64_t upTo)
+    {
+        std::vector<char> composite(upTo + 1, 0);
+        std::vector<uint32_t> primes;
+        for (uint64_t p = 3; p < upTo; p += 2) {
+            if (composite[p])
+                continue;
+            primes.push_back(uint32_t(p));
+            for (uint64_t m = p * p; m < upTo; m += 2 * p)
+                composite[m] = 1;
+        }
+        return primes;
+    }
+
+    // Sets the bits of count words holding the odd numbers from low (odd)
+    // upwards, then clears the odd multiples of every base prime.
+    static void markSegment(uint64_t* segment, size_t count, uint64_t low, const std::vector<uint32_t>& primes)
+    {
+        std::fill(segment, segment + count, ~uint64_t(0));
+        uint64_t high = low + 128 * uint64_t(count);
+        for (uint32_t p : primes) {
+            uint64_t square = uint64_t(p) * p;
+            if (square >= high)
+                break;
+            uint64_t first = std::max(square, (low + p - 1) / p * p);
+            if (first % 2 == 0)
+                first += p;
+            for (uint64_t m = first; m < high; m += 2 * uint64_t(p)) {
+                uint64_t bit = (m - low) >> 1;
+                segment[bit >> 6] &= ~(uint64_t(1) << (bit & 63));
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> words;
+    uint64_t Limit = 0;
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "fractal.hpp"
+#include "precision.hpp"
+
+// Tile pyramid over a base viewport: zoom level z splits it into 2^z x 2^z
+// tiles of TileSize x TileSize pixels. The base centre is double-double, so
+// deep levels keep their position instead of collapsing onto double grid
+// points. Tiles hold iteration counts, so the
+// same cached tile can be colorized any way the caller likes.
+
+const int TileSize = 256;
+
+struct TileKey {
+    std::string formula;
+    uint64_t base; // TilePyramid::baseHash(), pyramids over different views never share tiles
+    int zoom;
+    int tileX;
+    int tileY;
+    int iterationMax;
+
+    bool operator==(const TileKey& other) const
+    {
+        return zoom == other.zoom && tileX == other.tileX && tileY == other.tileY
+            && iterationMax == other.iterationMax && base == other.base && formula == other.formula;
+    }
+
+    std::string fileName() const
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016" PRIx64, base);
+        return formula + "_" + hex + "_" + std::to_string(iterationMax) + "_" + std::to_string(zoom) + "_"
+            + std::to_string(tileX) + "_" + std::to_string(tileY) + ".tile";
+    }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& key) const
+    {
+        size_t h = std::hash<std::string>()(key.formula) ^ std::hash<uint64_t>()(key.base);
+        for (int v : { key.zoom, key.tileX, key.tileY, key.iterationMax })
+            h = h * 1000003 ^ std::hash<int>()(v);
+        return h;
+    }
+};
+
+struct Tile {
+    std::vector<int> iterations = std::vector<int>(TileSize * TileSize);
+
+    const int* row(int y) const { return iterations.data() + y * TileSize; }
+    int* row(int y) { return iterations.data() + y * TileSize; }
+};
+
+using TilePtr = std::shared_ptr<const Tile>;
+
+// Thread-safe two-level cache: an LRU list bounded by memoryBudget bytes and,
+// if diskDirectory is set, a write-through directory of raw tiles that are
+// read back in when they fall out of memory.
+class TileCache {
+public:
+    TileCache(size_t memoryBudget = size_t(256) << 20, const std::string& diskDirectory = "")
+        : MemoryBudget(memoryBudget)
+        , DiskDirectory(diskDirectory)
+    {
+        if (!DiskDirectory.empty())
+            mkdir(DiskDirectory.c_str(), 0755);
+    }
+
+    // Memory tier only, never touches the disk. A miss is not counted, the
+    // caller is expected to follow up with find().
+    TilePtr findMemory(const TileKey& key)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        auto it = Index.find(key);
+        if (it == Index.end())
+            return nullptr;
+        Lru.splice(Lru.begin(), Lru, it->second);
+        ++MemoryHits;
+        return it->second->second;
+    }
+
+    TilePtr find(const TileKey& key)
+    {
+        if (TilePtr tile = findMemory(key))
+            return tile;
+
+        TilePtr tile = loadFromDisk(key);
+        if (tile) {
+            insertMemory(key, tile);
+            std::lock_guard<std::mutex> guard(mtx);
+            ++DiskHits;
+            return tile;
+        }
+
+        std::lock_guard<std::mutex> guard(mtx);
+        ++Misses;
+        return nullptr;
+    }
+
+    void insert(const TileKey& key, TilePtr tile)
+    {
+        insertMemory(key, tile);
+        saveToDisk(key, *tile);
+    }
+
+    long memoryHits() const { return MemoryHits; }
+    long diskHits() const { return DiskHits; }
+    long misses() const { return Misses; }
+    size_t memoryUsed()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        return Lru.size() * sizeof(int) * TileSize * TileSize;
+    }
+
+    void resetStats()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        MemoryHits = DiskHits = Misses = 0;
+    }
+
+private:
+    using Entry = std::pair<TileKey, TilePtr>;
+
+    size_t MemoryBudget;
+    std::string DiskDirectory;
+
+    std::mutex mtx;
+    std::list<Entry> Lru;
+    std::unordered_map<TileKey, std::list<Entry>::iterator, TileKeyHash> Index;
+
+    long MemoryHits = 0;
+    long DiskHits = 0;
+    long Misses = 0;
+
+    void insertMemory(const TileKey& key, TilePtr tile)
+    {
+        const size_t tileBytes = sizeof(int) * TileSize * TileSize;
+
+        std::lock_guard<std::mutex> guard(mtx);
+        auto it = Index.find(key);
+        if (it != Index.end()) {
+            Lru.splice(Lru.begin(), Lru, it->second);
+            return;
+        }
+        Lru.emplace_front(key, tile);
+        Index[key] = Lru.begin();
+
+        while (Lru.size() > 1 && Lru.size() * tileBytes > MemoryBudget) {
+            Index.erase(Lru.back().first);
+            Lru.pop_back();
+        }
+    }
+
+    TilePtr loadFromDisk(const TileKey& key)
+    {
+        if (DiskDirectory.empty())
+            return nullptr;
+
+        const size_t tileBytes = sizeof(int) * TileSize * TileSize;
+        int fd = open((DiskDirectory + "/" + key.fileName()).c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+
+        // Plain read() straight into the tile's vector. Mapping the file only
+        // to copy it out again costs an mmap, page faults and an munmap on
+        // top of the same copy.
+        struct stat st;
+        TilePtr result;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) == tileBytes) {
+            auto tile = std::make_shared<Tile>();
+            char* dst = reinterpret_cast<char*>(tile->iterations.data());
+            size_t done = 0;
+            while (done < tileBytes) {
+                ssize_t n = read(fd, dst + done, tileBytes - done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                done += size_t(n);
+            }
+            if (done == tileBytes)
+                result = tile;
+        }
+        close(fd);
+        return result;
+    }
+
+    void saveToDisk(const TileKey& key, const Tile& tile)
+    {
+        if (DiskDirectory.empty())
+            return;
+
+        // Written under a temporary name and renamed, so a concurrent reader
+        // never reads a half-written tile.
+        std::string path = DiskDirectory + "/" + key.fileName();
+        std::string tmp = path + "." + std::to_string(getpid()) + "."
+            + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return;
+
+        const size_t tileBytes = sizeof(int) * TileSize * TileSize;
+        bool ok = write(fd, tile.iterations.data(), tileBytes) == ssize_t(tileBytes);
+        close(fd);
+        if (ok)
+            rename(tmp.c_str(), path.c_str());
+        else
+            unlink(tmp.c_str());
+    }
+};
+
+///////////////////////////////////////////
+
+template <class Formula>
+class TilePyramid {
+public:
+    // base covers level 0, a single TileSize x TileSize tile. Every tile is
+    // rendered with the same tier, so tiles of one pyramid are comparable
+    // with each other and with an uncached render at that tier.
+    TilePyramid(TileCache& cache, int iterationMax, PrecisionTier tier = PrecisionTier::Double,
+        const Formula& formula = Formula(),
+        const DeepViewport& base = DeepViewport(-0.5, 0, 4.0 / TileSize, TileSize, TileSize),
+        const std::string& tag = Formula::name())
+        : Cache(cache)
+        , IterationMax(iterationMax)
+        , Tier(tier)
+        , F(formula)
+        , Base(base)
+        , Tag(tag)
+        , BaseHash(baseHash(base, tier))
+    {
+    }
+
+    int iterationMax() const { return IterationMax; }
+    PrecisionTier tier() const { return Tier; }
+
+    TileKey key(int zoom, int tileX, int tileY) const { return { Tag, BaseHash, zoom, tileX, tileY, IterationMax }; }
+
+    // The width x height window starting at (px0, py0) in the global pixel
+    // grid of level zoom, offset from the base centre in double-double.
+    DeepViewport windowViewport(int zoom, long px0, long py0, int width, int height) const
+    {
+        double pixelSize = Base.PixelSize / double(1L << zoom);
+        double half = double(1L << zoom) * TileSize / 2;
+        double dx = px0 + width / 2.0 - half;
+        double dy = py0 + height / 2.0 - half;
+        return { Base.Cx + DoubleDouble(dx) * pixelSize, Base.Cy + DoubleDouble(dy) * pixelSize, pixelSize,
+            width, height };
+    }
+
+    DeepViewport tileViewport(int zoom, int tileX, int tileY) const
+    {
+        return windowViewport(zoom, long(tileX) * TileSize, long(tileY) * TileSize, TileSize, TileSize);
+    }
+
+    TilePtr renderTile(int zoom, int tileX, int tileY) const
+    {
+        auto tile = std::make_shared<Tile>();
+        DeepViewport view = tileViewport(zoom, tileX, tileY);
+        withPrecision(Tier, view, IterationMax, 2, F, [&](const auto& engine) {
+            for (int iY = 0; iY < TileSize; ++iY)
+                engine.renderRow(iY, 0, TileSize, tile->row(iY));
+        });
+        return tile;
+    }
+
+    // Cached tile, rendered and inserted on a miss.
+    TilePtr tile(int zoom, int tileX, int tileY)
+    {
+        TileKey k = key(zoom, tileX, tileY);
+        TilePtr t = Cache.find(k);
+        if (!t) {
+            t = renderTile(zoom, tileX, tileY);
+            Cache.insert(k, t);
+        }
+        return t;
+    }
+
+    // Iteration counts for the width x height pixel window starting at
+    // (px0, py0) in the global pixel grid of level zoom. Tiles already in
+    // the cache are reused, the missing ones are rendered in parallel.
+    void render(int zoom, long px0, long py0, int width, int height, int* out)
+    {
+        // Floor division: windows may start left of or above the origin.
+        auto tileOf = [](long p) { return p >= 0 ? p / TileSize : -((-p + TileSize - 1) / TileSize); };
+        const long tiles = 1L << zoom;
+        long tx0 = std::max(0L, tileOf(px0));
+        long ty0 = std::max(0L, tileOf(py0));
+        long tx1 = std::min(tiles - 1, tileOf(px0 + width - 1));
+        long ty1 = std::min(tiles - 1, tileOf(py0 + height - 1));
+
+        std::fill(out, out + long(width) * height, 0);
+        if (tx0 > tx1 || ty0 > ty1)
+            return;
+
+        struct Slot {
+            int tx, ty;
+            TilePtr tile;
+        };
+        std::vector<Slot> slots;
+        std::vector<int> missing;
+        for (long ty = ty0; ty <= ty1; ++ty) {
+            for (long tx = tx0; tx <= tx1; ++tx) {
+                slots.push_back({ int(tx), int(ty), Cache.find(key(zoom, tx, ty)) });
+                if (!slots.back().tile)
+                    missing.push_back(int(slots.size()) - 1);
+            }
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < missing.size(); ++i) {
+            Slot& s = slots[missing[i]];
+            s.tile = renderTile(zoom, s.tx, s.ty);
+            Cache.insert(key(zoom, s.tx, s.ty), s.tile);
+        }
+
+        for (const Slot& s : slots) {
+            long x0 = std::max(px0, long(s.tx) * TileSize);
+            long x1 = std::min(px0 + width, long(s.tx + 1) * TileSize);
+            long y0 = std::max(py0, long(s.ty) * TileSize);
+            long y1 = std::min(py0 + height, long(s.ty + 1) * TileSize);
+            if (x1 <= x0 || y1 <= y0)
+                continue;
+            for (long y = y0; y < y1; ++y) {
+                std::memcpy(out + (y - py0) * width + (x0 - px0),
+                    s.tile->row(int(y - long(s.ty) * TileSize)) + (x0 - long(s.tx) * TileSize),
+                    sizeof(int) * (x1 - x0));
+            }
+        }
+    }
+
+private:
+    TileCache& Cache;
+    int IterationMax;
+    PrecisionTier Tier;
+    Formula F;
+    DeepViewport Base;
+    std::string Tag;
+    uint64_t BaseHash;
+
+    // FNV-1a over everything besides the key fields that changes a tile.
+    static uint64_t baseHash(const DeepViewport& base, PrecisionTier tier)
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](const void* data, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                h ^= static_cast<const unsigned char*>(data)[i];
+                h *= 1099511628211ull;
+            }
+        };
+        for (double v : { base.Cx.hi, base.Cx.lo, base.Cy.hi, base.Cy.lo, base.PixelSize })
+            mix(&v, sizeof(v));
+        int t = int(tier);
+        mix(&t, sizeof(t));
+        return h;
+    }
+};
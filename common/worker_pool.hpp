@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "placement.hpp"
+
+// Fixed set of worker threads fed from a bounded FIFO. tryPush refuses work
+// when the queue is full instead of blocking, so callers can push back on
+// their own clients. Worker i pins itself with the given placement.
+class WorkerPool {
+public:
+    WorkerPool(int threads, size_t capacity, const Placement& placement = Placement())
+        : Capacity(capacity)
+        , placement(placement)
+    {
+        for (int i = 0; i < threads; ++i)
+            workers.emplace_back(&WorkerPool::workerLoop, this, i);
+    }
+
+    ~WorkerPool() { stop(); }
+
+    // Runs what is already queued, then joins the workers. Owners whose
+    // tasks touch their other members call this before tearing those down.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            stopping = true;
+        }
+        notEmpty.notify_all();
+        for (auto& t : workers)
+            if (t.joinable())
+                t.join();
+    }
+
+    bool tryPush(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            if (queue.size() >= Capacity)
+                return false;
+            queue.push_back(std::move(task));
+        }
+        notEmpty.notify_one();
+        return true;
+    }
+
+    size_t queued()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        return queue.size();
+    }
+
+    int threads() const { return int(workers.size()); }
+    size_t capacity() const { return Capacity; }
+    std::string placementName() const { return pinFailed ? "unpinned" : placement.name(); }
+
+private:
+    size_t Capacity;
+    Placement placement;
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mtx;
+    std::condition_variable notEmpty;
+    bool stopping = false;
+    std::atomic<bool> pinFailed { false };
+
+    void workerLoop(int tid)
+    {
+        if (!placement.pinCurrentThread(tid))
+            pinFailed = true;
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                notEmpty.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+};